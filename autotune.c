@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "autotune.h"
+#include "session.h"
+
+// The grid: tasklet counts whose variant is looked for, and block sizes
+static const uint32_t TUNE_TASKLETS[] = {1, 2, 4, 8, 11, 12, 14, 16, 20, 24};
+static const uint32_t TUNE_BLOCK_BYTES[] = {512, 1024, 2048, 4096};
+
+#define NR_TUNE_TASKLETS (sizeof(TUNE_TASKLETS) / sizeof(TUNE_TASKLETS[0]))
+#define NR_TUNE_BLOCK_BYTES (sizeof(TUNE_BLOCK_BYTES) / sizeof(TUNE_BLOCK_BYTES[0]))
+
+// Ceiling of log2
+static uint32_t bucket(uint32_t x) {
+    uint32_t b = 0;
+
+    while (b < 31 && (1u << b) < x) {
+        b++;
+    }
+    return b;
+}
+
+int kmeans_tuning_lookup(const char *cache, uint32_t points_per_dpu, uint32_t dims, uint32_t k,
+                         kmeans_tuning_t *tuning) {
+    FILE *file = fopen(cache, "r");
+    char line[256];
+    int found = -1;
+
+    if (!file) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), file)) {
+        uint32_t points_bucket, dims_bucket, k_bucket;
+        kmeans_tuning_t entry;
+        if (line[0] == '#' || sscanf(line, "%u %u %u %u %u %lf", &points_bucket, &dims_bucket, &k_bucket,
+                                     &entry.nr_tasklets, &entry.block_bytes, &entry.cycles_per_point) != 6) {
+            continue;
+        }
+        if (points_bucket == bucket(points_per_dpu) && dims_bucket == bucket(dims) && k_bucket == bucket(k)) {
+            *tuning = entry;
+            found = 0;
+        }
+    }
+    fclose(file);
+    return found;
+}
+
+int kmeans_tuning_binary(const char *binary, uint32_t nr_tasklets, char *path, size_t size) {
+    FILE *file;
+    int length = snprintf(path, size, "%s-t%u", binary, nr_tasklets);
+
+    if (length < 0 || (size_t)length >= size || !(file = fopen(path, "rb"))) {
+        return -1;
+    }
+    fclose(file);
+    return 0;
+}
+
+static int append_tuning(const char *cache, uint32_t points_per_dpu, uint32_t dims, uint32_t k,
+                         const kmeans_tuning_t *tuning) {
+    FILE *file = fopen(cache, "a");
+
+    if (!file) {
+        printf("Error: cannot write the tuning cache %s\n", cache);
+        return -1;
+    }
+    if (ftell(file) == 0) {
+        fprintf(file, "# log2(points per DPU) log2(D) log2(K) tasklets block_bytes cycles_per_point\n");
+    }
+    fprintf(file, "%u %u %u %u %u %.3f\n", bucket(points_per_dpu), bucket(dims), bucket(k), tuning->nr_tasklets,
+            tuning->block_bytes, tuning->cycles_per_point);
+    fclose(file);
+    return 0;
+}
+
+// Cycles per point and assignment pass of one configuration into *cycles;
+// returns the status of the run (enum kmeans_status)
+static int measure(kmeans_session_t *session, uint32_t sample, uint32_t dims, uint32_t k, double *cycles) {
+    dpu_generator_t generator = {1, k, 0.05f, 0};
+    float *centroids = malloc((size_t)k * dims * sizeof(float));
+    kmeans_job_t job;
+    int status = KMEANS_NO_MEMORY;
+
+    memset(&job, 0, sizeof(job));
+    job.generator = &generator;
+    job.nr_points = sample * session->nr_dpus;
+    job.dims = dims;
+    job.k = k;
+    job.max_iterations = TUNE_ITERATIONS;
+    job.seed = 1;
+    job.centroids = centroids;
+    if (centroids && (status = kmeans_session_run(session, &job)) == KMEANS_OK) {
+        *cycles = job.iterations > 0 ? (double)job.dpu_cycles / job.iterations / sample : -1.0;
+    }
+    free(centroids);
+    return status;
+}
+
+int kmeans_tune(const char *binary, const char *cache, uint32_t nr_dpus, const char *profile, uint32_t nr_points,
+                uint32_t dims, uint32_t k, FILE *log, kmeans_tuning_t *best) {
+    char path[TUNE_PATH_BYTES];
+    uint32_t points_per_dpu = 0;
+
+    best->cycles_per_point = -1.0;
+    for (uint32_t t = 0; t < NR_TUNE_TASKLETS; t++) {
+        kmeans_session_t session;
+        kmeans_tuning_t variant = {TUNE_TASKLETS[t], 0, -1.0};
+        uint32_t sample;
+
+        if (kmeans_tuning_binary(binary, TUNE_TASKLETS[t], path, sizeof(path)) != 0 ||
+            kmeans_session_open_profile(&session, nr_dpus, profile, path) != 0) {
+            continue;
+        }
+        // Every variant gets the same sample, at least k points, spread like the job
+        points_per_dpu = (nr_points + session.nr_dpus - 1) / session.nr_dpus;
+        sample = points_per_dpu < TUNE_SAMPLE_POINTS ? points_per_dpu : TUNE_SAMPLE_POINTS;
+        sample = sample < k ? k : sample;
+        for (uint32_t b = 0; b < NR_TUNE_BLOCK_BYTES; b++) {
+            double cycles = -1.0;
+            int status;
+            session.block_bytes = TUNE_BLOCK_BYTES[b];
+            status = measure(&session, sample, dims, k, &cycles);
+            // A variant whose launch failed is dropped whole, its DPUs may be left faulted
+            if (status == KMEANS_DPU_ERROR) {
+                if (log) {
+                    fprintf(log, "%2u tasklets: the launch failed, variant skipped\n", TUNE_TASKLETS[t]);
+                }
+                variant.cycles_per_point = -1.0;
+                break;
+            }
+            if (status != KMEANS_OK || cycles < 0.0) {
+                continue;
+            }
+            if (log) {
+                fprintf(log, "%2u tasklets, %4u-byte blocks: %.1f cycles per point\n", TUNE_TASKLETS[t],
+                        TUNE_BLOCK_BYTES[b], cycles);
+            }
+            if (variant.cycles_per_point < 0.0 || cycles < variant.cycles_per_point) {
+                variant.block_bytes = TUNE_BLOCK_BYTES[b];
+                variant.cycles_per_point = cycles;
+            }
+        }
+        kmeans_session_close(&session);
+        if (variant.cycles_per_point >= 0.0 &&
+            (best->cycles_per_point < 0.0 || variant.cycles_per_point < best->cycles_per_point)) {
+            *best = variant;
+        }
+    }
+
+    if (best->cycles_per_point < 0.0) {
+        printf("Error: no %s-t<tasklets> variant could run N=%u, D=%u, K=%u\n", binary, nr_points, dims, k);
+        return -1;
+    }
+    return append_tuning(cache, points_per_dpu, dims, k, best);
+}
@@ -0,0 +1,45 @@
+#ifndef _AUTOTUNE_H_
+#define _AUTOTUNE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Kernel autotuning per job shape. NR_TASKLETS is fixed when dpu.c is
+// compiled, so every tasklet count is its own binary, <binary>-t<T> (see
+// README.md), while the size of the point blocks streamed into WRAM is a
+// launch argument. kmeans_tune() runs a few iterations of a generated sample
+// with every variant that was built and every TUNE_BLOCK_BYTES size, and
+// appends the one with the fewest cycles per point and iteration to a cache
+// file; kmeans_session_open_tuned() consults it before loading the kernel.
+// Whether the centroids stay in WRAM or stream through it (tiled) follows from
+// the tasklets and the block size, so the grid covers both kernel paths.
+
+#define TUNE_CACHE "kmeans_tune.txt"
+#define TUNE_PATH_BYTES 4096
+#define TUNE_SAMPLE_POINTS (1 << 16)  // Per DPU, at most
+#define TUNE_ITERATIONS 3
+
+typedef struct {
+    uint32_t nr_tasklets;
+    uint32_t block_bytes;
+    double cycles_per_point;  // Of one assignment pass, on the slowest DPU
+} kmeans_tuning_t;
+
+// Shapes are looked up by class: power-of-two buckets of the points per DPU,
+// dims and k. The last entry of a class wins. Returns -1 if there is none.
+int kmeans_tuning_lookup(const char *cache, uint32_t points_per_dpu, uint32_t dims, uint32_t k,
+                         kmeans_tuning_t *tuning);
+
+// Path of the nr_tasklets variant of binary; -1 if it was not built
+int kmeans_tuning_binary(const char *binary, uint32_t nr_tasklets, char *path, size_t size);
+
+// Tune a job of nr_points x dims into k clusters on nr_dpus DPUs allocated
+// with profile (as for kmeans_session_open_profile, NULL for the default),
+// logging every configuration to log if not NULL. Variants whose launch fails
+// are skipped and never cached. Returns 0 and the best configuration, -1 if
+// no variant could run the shape.
+int kmeans_tune(const char *binary, const char *cache, uint32_t nr_dpus, const char *profile, uint32_t nr_points,
+                uint32_t dims, uint32_t k, FILE *log, kmeans_tuning_t *best);
+
+#endif
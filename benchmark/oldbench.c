@@ -38,11 +38,13 @@ int main() {
     // Initialize performance counters
     perfcounter_config(COUNT_CYCLES, true);  
 
-    // Initialize MRAM data (for testing purposes)
-    for(int i = 0; i < N_POINTS; i++) {
-        points[i][0] = (float)i;
-        points[i][1] = (float)i;
+    // Initialize MRAM data (for testing purposes), every dimension, each tasklet on its own points
+    for(int i = me(); i < N_POINTS; i += NR_TASKLETS) {
+        for (int d = 0; d < DIMENSIONS; d++) {
+            points[i][d] = (float)i;
+        }
     }
+    barrier_wait(&my_barrier);
 
     perfcounter_t transfer_start, transfer_end;
     unsigned long transfer_duration_original = 0;
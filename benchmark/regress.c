@@ -0,0 +1,437 @@
+// clock_gettime under --std=c99
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "autotune.h"
+#include "session.h"
+
+// Performance regression suite: runs canonical jobs on the functional
+// simulator, reads the DPU cycle counters per phase (enum dpu_phase) and the
+// host wall time, and compares them with a baseline recorded by an earlier run.
+//
+// Usage: ./regress [-r] [-l] [-a] [-c pct] [-w pct] [-b baseline] [-d binary] [config...]
+// With -r the measurements are written to the baseline instead of compared
+// (entries of configs not run are kept). With -l the slow configs run too.
+// With -a TUNE_CONFIG is first autotuned over the <binary>-t<tasklets>
+// variants (see autotune.h), and the variant picked must run it.
+// -c and -w set the tolerated slowdown of DPU cycles and of wall time.
+// Exits with 1 if anything regressed past its threshold, 2 on errors,
+// including a missing baseline when not recording one.
+//
+// No baseline is committed: cycle counts depend on the SDK version and wall
+// times on the machine. Bootstrap one on the reference machine with
+// ./regress -r (and -l for the slow configs), commit
+// benchmark/baseline-v<REGRESS_VERSION>.txt, then run ./regress.
+
+// Bumped whenever the configs, the data or what is measured change, so
+// numbers of different suites are never compared; every version has its own file
+#define REGRESS_VERSION 1
+#define STRINGIFY(x) #x
+#define TOSTRING(x) STRINGIFY(x)
+#define REGRESS_BASELINE "benchmark/baseline-v" TOSTRING(REGRESS_VERSION) ".txt"
+#define REGRESS_BINARY "./dpu"
+#define REGRESS_PROFILE "backend=simulator"
+#define REGRESS_DPUS 4
+#define REGRESS_ITERATIONS 10
+#define REGRESS_SEED 1
+#define CYCLES_THRESHOLD 2.0  // Percent: the simulator's cycle counts are deterministic
+#define WALL_THRESHOLD 25.0   // Percent: wall time depends on the machine's load
+#define MAX_ENTRIES 256
+#define NAME_BYTES 32
+
+typedef struct {
+    const char *name;
+    uint32_t nr_points;
+    uint32_t dims;
+    uint32_t k;
+    uint32_t format;         // enum point_format
+    uint32_t spatial_order;
+    int slow;                // Only with -l: hours on the functional simulator
+} regress_config_t;
+
+static const regress_config_t CONFIGS[] = {
+    {"small", 10000, 2, 6, POINTS_FP32, 0, 0},         // The case of dpu.c and benchmark/finalbench.c
+    {"small-uint16", 10000, 2, 6, POINTS_UINT16, 0, 0},
+    {"small-zorder", 10000, 2, 6, POINTS_FP32, 1, 0},
+    {"tiled", 4000, 256, 64, POINTS_FP32, 0, 0},       // Centroids streamed through WRAM
+    {"large", 4000000, 5, 150, POINTS_FP32, 0, 1},     // The case of benchmark/oldbench.c
+};
+#define NR_CONFIGS (sizeof(CONFIGS) / sizeof(CONFIGS[0]))
+
+// -a: the largest K x D, tiled on every tasklet count
+static const regress_config_t TUNE_CONFIG = {"tuned-tiled", 4000, 256, 256, POINTS_FP32, 0, 0};
+#define REGRESS_TUNE_CACHE "regress_tune.txt"
+
+// Metrics of one config, in this order in the baseline
+enum metric {
+    METRIC_ITERATIONS,
+    METRIC_CYCLES,
+    METRIC_SETUP_CYCLES,
+    METRIC_ASSIGN_CYCLES,
+    METRIC_REDUCE_CYCLES,
+    METRIC_FIT_MS,
+    METRIC_PREDICT_MS,
+    NR_METRICS
+};
+static const char *const METRIC_NAMES[NR_METRICS] = {"iterations",    "dpu_cycles", "setup_cycles", "assign_cycles",
+                                                     "reduce_cycles", "fit_ms",     "predict_ms"};
+
+typedef struct {
+    char config[NAME_BYTES];
+    char metric[NAME_BYTES];
+    double value;
+} entry_t;
+
+typedef struct {
+    uint32_t version;
+    uint32_t nr_dpus;
+    uint32_t nr_entries;
+    entry_t entries[MAX_ENTRIES];
+} baseline_t;
+
+static double elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// xorshift64*: the same points on every machine and libc
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ull;
+}
+
+static float uniform(uint64_t *state) {
+    return (float)(next_random(state) >> 40) / (float)(1 << 24);
+}
+
+// k blobs: centers in [0, 10)^dims, every point within 0.5 of its center
+// per coordinate, centers taken round-robin
+static void make_points(float *points, uint32_t nr_points, uint32_t dims, uint32_t k) {
+    uint64_t state = 0x9e3779b97f4a7c15ull;
+    float *centers = malloc((size_t)k * dims * sizeof(float));
+
+    for (uint32_t i = 0; i < k * dims; i++) {
+        centers[i] = 10.0f * uniform(&state);
+    }
+    for (uint32_t p = 0; p < nr_points; p++) {
+        const float *center = &centers[(size_t)(p % k) * dims];
+        for (uint32_t d = 0; d < dims; d++) {
+            points[(size_t)p * dims + d] = center[d] + uniform(&state) - 0.5f;
+        }
+    }
+    free(centers);
+}
+
+static int run_config(kmeans_session_t *session, const regress_config_t *config, double metrics[NR_METRICS]) {
+    float *points = malloc((size_t)config->nr_points * config->dims * sizeof(float));
+    float *centroids = malloc((size_t)config->k * config->dims * sizeof(float));
+    int *labels = malloc(config->nr_points * sizeof(int));
+    kmeans_job_t job;
+    struct timespec start;
+    int status = -1;
+
+    if (!points || !centroids || !labels) {
+        printf("Error: cannot allocate %u points of %u dimensions\n", config->nr_points, config->dims);
+        goto out;
+    }
+    make_points(points, config->nr_points, config->dims, config->k);
+
+    memset(&job, 0, sizeof(job));
+    job.points = points;
+    job.nr_points = config->nr_points;
+    job.dims = config->dims;
+    job.k = config->k;
+    job.max_iterations = REGRESS_ITERATIONS;
+    job.seed = REGRESS_SEED;
+    job.format = config->format;
+    job.spatial_order = config->spatial_order;
+    job.centroids = centroids;
+    job.labels = labels;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (kmeans_session_run(session, &job) != 0) {
+        goto out;
+    }
+    metrics[METRIC_FIT_MS] = elapsed_ms(&start);
+    metrics[METRIC_ITERATIONS] = job.iterations;
+    metrics[METRIC_CYCLES] = (double)job.dpu_cycles;
+    metrics[METRIC_SETUP_CYCLES] = (double)job.dpu_phase_cycles[PHASE_SETUP];
+    metrics[METRIC_ASSIGN_CYCLES] = (double)job.dpu_phase_cycles[PHASE_ASSIGN];
+    metrics[METRIC_REDUCE_CYCLES] = (double)job.dpu_phase_cycles[PHASE_REDUCE];
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (kmeans_session_load_centroids(session, centroids, config->k, config->dims) != 0 ||
+        kmeans_session_predict(session, points, config->nr_points, labels, NULL) != 0) {
+        goto out;
+    }
+    metrics[METRIC_PREDICT_MS] = elapsed_ms(&start);
+    status = 0;
+
+out:
+    free(points);
+    free(centroids);
+    free(labels);
+    return status;
+}
+
+// Autotune TUNE_CONFIG into a fresh cache, then run it with the variant and
+// block size the cache holds. Checks that no variant that cannot run the
+// shape gets picked.
+static int check_tuning(const char *binary) {
+    const regress_config_t *config = &TUNE_CONFIG;
+    char variant[TUNE_PATH_BYTES];
+    kmeans_tuning_t best, cached;
+    kmeans_session_t session;
+    double metrics[NR_METRICS];
+    int status = -1;
+
+    printf("%s: N=%u, D=%u, K=%u, autotuned\n", config->name, config->nr_points, config->dims, config->k);
+    remove(REGRESS_TUNE_CACHE);
+    if (kmeans_tune(binary, REGRESS_TUNE_CACHE, REGRESS_DPUS, REGRESS_PROFILE, config->nr_points, config->dims,
+                    config->k, stdout, &best) != 0 ||
+        kmeans_tuning_lookup(REGRESS_TUNE_CACHE, (config->nr_points + REGRESS_DPUS - 1) / REGRESS_DPUS, config->dims,
+                             config->k, &cached) != 0 ||
+        kmeans_tuning_binary(binary, cached.nr_tasklets, variant, sizeof(variant)) != 0) {
+        printf("Error: %s was not tuned\n", config->name);
+        goto out;
+    }
+    if (kmeans_session_open_profile(&session, REGRESS_DPUS, REGRESS_PROFILE, variant) != 0) {
+        goto out;
+    }
+    session.block_bytes = cached.block_bytes;
+    status = run_config(&session, config, metrics);
+    kmeans_session_close(&session);
+    if (status == 0) {
+        printf("  %u tasklets, %u-byte blocks: %u iterations\n", cached.nr_tasklets, cached.block_bytes,
+               (uint32_t)metrics[METRIC_ITERATIONS]);
+    }
+
+out:
+    remove(REGRESS_TUNE_CACHE);
+    return status;
+}
+
+// A missing file is an empty baseline
+static int load_baseline(const char *path, baseline_t *baseline) {
+    FILE *file = fopen(path, "r");
+    char line[128];
+
+    memset(baseline, 0, sizeof(*baseline));
+    if (!file) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), file)) {
+        entry_t *entry = &baseline->entries[baseline->nr_entries];
+        if (line[0] == '#' || sscanf(line, "version %u", &baseline->version) == 1 ||
+            sscanf(line, "dpus %u", &baseline->nr_dpus) == 1) {
+            continue;
+        }
+        if (baseline->nr_entries == MAX_ENTRIES) {
+            printf("Error: more than %u metrics in %s, raise MAX_ENTRIES\n", MAX_ENTRIES, path);
+            fclose(file);
+            return -1;
+        }
+        if (sscanf(line, "%31s %31s %lf", entry->config, entry->metric, &entry->value) != 3) {
+            printf("Error: malformed baseline %s: %s", path, line);
+            fclose(file);
+            return -1;
+        }
+        baseline->nr_entries++;
+    }
+    fclose(file);
+    return 0;
+}
+
+static int save_baseline(const char *path, const baseline_t *baseline) {
+    FILE *file = fopen(path, "w");
+
+    if (!file) {
+        printf("Error: cannot write %s\n", path);
+        return -1;
+    }
+    fprintf(file, "# k-means regression baseline, written by benchmark/regress.c -r\n");
+    fprintf(file, "# config metric value; cycles of the slowest DPU summed over the iterations\n");
+    fprintf(file, "version %u\ndpus %u\n", baseline->version, baseline->nr_dpus);
+    for (uint32_t e = 0; e < baseline->nr_entries; e++) {
+        const entry_t *entry = &baseline->entries[e];
+        fprintf(file, "%s %s %.3f\n", entry->config, entry->metric, entry->value);
+    }
+    fclose(file);
+    return 0;
+}
+
+static entry_t *find_entry(baseline_t *baseline, const char *config, const char *metric) {
+    for (uint32_t e = 0; e < baseline->nr_entries; e++) {
+        entry_t *entry = &baseline->entries[e];
+        if (strcmp(entry->config, config) == 0 && strcmp(entry->metric, metric) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Returns -1 if the baseline has no room left for a new metric
+static int record(baseline_t *baseline, const char *config, const double metrics[NR_METRICS]) {
+    for (uint32_t m = 0; m < NR_METRICS; m++) {
+        entry_t *entry = find_entry(baseline, config, METRIC_NAMES[m]);
+        if (!entry) {
+            if (baseline->nr_entries == MAX_ENTRIES) {
+                printf("Error: more than %u metrics in the baseline, raise MAX_ENTRIES\n", MAX_ENTRIES);
+                return -1;
+            }
+            entry = &baseline->entries[baseline->nr_entries++];
+            snprintf(entry->config, NAME_BYTES, "%s", config);
+            snprintf(entry->metric, NAME_BYTES, "%s", METRIC_NAMES[m]);
+        }
+        entry->value = metrics[m];
+    }
+    return 0;
+}
+
+// Print every metric next to its baseline; returns the number of regressions
+static uint32_t compare(baseline_t *baseline, const char *config, const double metrics[NR_METRICS],
+                        double cycles_threshold, double wall_threshold) {
+    uint32_t regressions = 0;
+
+    for (uint32_t m = 0; m < NR_METRICS; m++) {
+        const entry_t *entry = find_entry(baseline, config, METRIC_NAMES[m]);
+        double threshold = m == METRIC_FIT_MS || m == METRIC_PREDICT_MS ? wall_threshold : cycles_threshold;
+        const char *verdict = "";
+        double change = 0.0;
+
+        if (!entry) {
+            printf("  %-14s %16.1f  (no baseline)\n", METRIC_NAMES[m], metrics[m]);
+            continue;
+        }
+        if (entry->value > 0.0) {
+            change = 100.0 * (metrics[m] - entry->value) / entry->value;
+        }
+        if (m == METRIC_ITERATIONS) {
+            // Cycles of a different number of iterations are not comparable
+            if (metrics[m] != entry->value) {
+                verdict = "  CHANGED";
+                regressions++;
+            }
+        } else if (change > threshold) {
+            verdict = "  REGRESSION";
+            regressions++;
+        } else if (change < -threshold) {
+            verdict = "  faster, record a new baseline";
+        }
+        printf("  %-14s %16.1f  baseline %16.1f  %+7.2f%%%s\n", METRIC_NAMES[m], metrics[m], entry->value, change,
+               verdict);
+    }
+    return regressions;
+}
+
+static int selected(const regress_config_t *config, char **names, int nr_names, int slow) {
+    if (nr_names == 0) {
+        return !config->slow || slow;
+    }
+    for (int i = 0; i < nr_names; i++) {
+        if (strcmp(names[i], config->name) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    static baseline_t baseline;
+    kmeans_session_t session;
+    const char *path = REGRESS_BASELINE;
+    const char *binary = REGRESS_BINARY;
+    double cycles_threshold = CYCLES_THRESHOLD, wall_threshold = WALL_THRESHOLD;
+    int write = 0, slow = 0, tune = 0, arg = 1;
+    uint32_t regressions = 0, errors = 0;
+
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-r") == 0) {
+            write = 1;
+        } else if (strcmp(argv[arg], "-l") == 0) {
+            slow = 1;
+        } else if (strcmp(argv[arg], "-a") == 0) {
+            tune = 1;
+        } else if (strcmp(argv[arg], "-c") == 0 && arg + 1 < argc) {
+            cycles_threshold = atof(argv[++arg]);
+        } else if (strcmp(argv[arg], "-w") == 0 && arg + 1 < argc) {
+            wall_threshold = atof(argv[++arg]);
+        } else if (strcmp(argv[arg], "-b") == 0 && arg + 1 < argc) {
+            path = argv[++arg];
+        } else if (strcmp(argv[arg], "-d") == 0 && arg + 1 < argc) {
+            binary = argv[++arg];
+        } else {
+            printf("Usage: %s [-r] [-l] [-a] [-c pct] [-w pct] [-b baseline] [-d binary] [config...]\n", argv[0]);
+            return 2;
+        }
+    }
+    for (int i = arg; i < argc; i++) {
+        uint32_t c = 0;
+        while (c < NR_CONFIGS && strcmp(CONFIGS[c].name, argv[i]) != 0) {
+            c++;
+        }
+        if (c == NR_CONFIGS) {
+            printf("Error: unknown config %s\n", argv[i]);
+            return 2;
+        }
+    }
+
+    if (load_baseline(path, &baseline) != 0) {
+        return 2;
+    }
+    if (baseline.nr_entries > 0 && (baseline.version != REGRESS_VERSION || baseline.nr_dpus != REGRESS_DPUS)) {
+        printf("Error: %s is version %u on %u DPUs, this suite is version %u on %u DPUs\n", path, baseline.version,
+               baseline.nr_dpus, REGRESS_VERSION, REGRESS_DPUS);
+        return 2;
+    }
+    if (!write && baseline.nr_entries == 0) {
+        printf("Error: no baseline in %s, record one with -r\n", path);
+        return 2;
+    }
+    baseline.version = REGRESS_VERSION;
+    baseline.nr_dpus = REGRESS_DPUS;
+
+    if (tune && check_tuning(binary) != 0) {
+        printf("  failed\n");
+        errors++;
+    }
+    if (kmeans_session_open_profile(&session, REGRESS_DPUS, REGRESS_PROFILE, binary) != 0) {
+        return 2;
+    }
+    for (uint32_t c = 0; c < NR_CONFIGS; c++) {
+        const regress_config_t *config = &CONFIGS[c];
+        double metrics[NR_METRICS];
+
+        if (!selected(config, &argv[arg], argc - arg, slow)) {
+            continue;
+        }
+        printf("%s: N=%u, D=%u, K=%u%s%s\n", config->name, config->nr_points, config->dims, config->k,
+               config->format == POINTS_UINT16 ? ", uint16" : "", config->spatial_order ? ", Z-order" : "");
+        if (run_config(&session, config, metrics) != 0) {
+            printf("  failed\n");
+            errors++;
+        } else if (write) {
+            errors += record(&baseline, config->name, metrics) != 0;
+        } else {
+            regressions += compare(&baseline, config->name, metrics, cycles_threshold, wall_threshold);
+        }
+    }
+    kmeans_session_close(&session);
+
+    if (write && errors == 0) {
+        if (save_baseline(path, &baseline) != 0) {
+            return 2;
+        }
+        printf("Baseline written to %s\n", path);
+    } else if (!write) {
+        printf("%u regression%s\n", regressions, regressions == 1 ? "" : "s");
+    }
+    return errors ? 2 : regressions ? 1 : 0;
+}
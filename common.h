@@ -0,0 +1,209 @@
+#ifndef _COMMON_H_
+#define _COMMON_H_
+
+#include <stdint.h>
+
+// Layout shared by host.c and dpu.c. Everything here must have the same size
+// and alignment on the host and on the DPU.
+
+#define MAX_DIMENSIONS 256
+#define MAX_K 4096
+#define MAX_CENTROID_FLOATS (1 << 16)  // Bound on K x D: 256 KB of centroids
+
+// MRAM budget of one DPU (64 MB in total)
+#define MAX_POINTS_PER_DPU (2 << 20)
+#define MAX_POINT_FLOATS (8 << 20)  // 32 MB of coordinates
+
+// MRAM<->WRAM transfers must be 8-byte aligned, 8-byte sized and at most 2048 bytes
+#define MRAM_ALIGN 8
+#define MAX_DMA_BYTES 2048
+#define BLOCK_BYTES 2048  // Points streamed into WRAM per tasklet per DMA, unless the launch sets block_bytes
+
+// Shards and tasklet ranges start and end on a multiple of SHARD_ALIGN points,
+// so that every point/label transfer stays 8-byte aligned whatever the dimension
+#define SHARD_ALIGN 8
+
+#define ALIGN_UP(x, a) (((x) + (a) - 1) / (a) * (a))
+#define ALIGN8(x) ALIGN_UP((x), MRAM_ALIGN)
+
+// Points per WRAM block of block_bytes (0 for BLOCK_BYTES), kept a multiple of
+// SHARD_ALIGN so block boundaries stay aligned; above block_bytes / SHARD_ALIGN
+// bytes per point a block is SHARD_ALIGN points
+static inline uint32_t points_per_block(uint32_t dims, uint32_t block_bytes) {
+    uint32_t bytes = block_bytes ? block_bytes : BLOCK_BYTES;
+    uint32_t points = (bytes / (dims * sizeof(float))) / SHARD_ALIGN * SHARD_ALIGN;
+    return points > SHARD_ALIGN ? points : SHARD_ALIGN;
+}
+
+// Spatially ordered jobs cut each shard into tiles of tile_points points (at
+// most one block) and store the bounding box of every tile, min[dims] then
+// max[dims], so the DPU can skip the centroids no point of a tile can be closest to.
+// Aim for enough tiles per shard to keep every tasklet busy. Tiles hold at
+// least SHARD_ALIGN points, so the boxes take at most a quarter of the coordinates.
+#define TILES_PER_SHARD 64
+#define MAX_TILE_BOUND_FLOATS (MAX_POINT_FLOATS / 4)
+
+// Cluster labels are packed on 1 byte up to 256 clusters and on 2 bytes above.
+// A block of SHARD_ALIGN labels is then always a whole number of 8-byte words.
+#define MAX_LABEL_BYTES 2
+
+static inline uint32_t label_bytes(uint32_t k) {
+    return k <= 256 ? 1 : 2;
+}
+
+// MODE_STEP: one Lloyd iteration over a shard of a job spread on all DPUs.
+// MODE_BATCH: the shard is a whole independent problem, iterated on the DPU.
+// MODE_PREDICT: label the shard against the resident centroids, nothing else.
+// MODE_GENERATE: fill the shard with synthetic points, see generate_point().
+enum kernel_mode { MODE_STEP, MODE_BATCH, MODE_PREDICT, MODE_GENERATE };
+
+// MODE_PREDICT: points per DPU and launch, and their distances to the closest centroid
+#define MAX_PREDICT_POINTS (1 << 16)
+
+// Coordinates are stored in MRAM either as floats or, to halve the host->MRAM
+// traffic and the MRAM footprint, as uint16 scaled per dimension
+enum point_format { POINTS_FP32, POINTS_UINT16 };
+
+// Dequantization of POINTS_UINT16 coordinates: x[d] = offset[d] + scale[d] * q[d]
+typedef struct {
+    float offset[MAX_DIMENSIONS];
+    float scale[MAX_DIMENSIONS];
+} dpu_quantization_t;
+
+// WRAM heap of a kernel built with nr_tasklets tasklets, assuming the default
+// 1 KB stack per tasklet and 8 KB of globals and runtime
+#define WRAM_HEAP(nr_tasklets) ((56 << 10) - (nr_tasklets) * 1024)
+
+// Tiled mode (see dpu.c) streams the centroids through WRAM in chunks of
+// TILE_CENTROIDS x TILE_DIMS against blocks of TILE_POINTS points. Above 16
+// tasklets the chunks are halved, so that the tile buffers of every tasklet
+// fit next to each other for any supported K and D (see TILED_WRAM_BYTES).
+#define TILE_POINTS SHARD_ALIGN
+#define TILED_CENTROIDS(nr_tasklets) ((nr_tasklets) > 16 ? 4 : 8)
+#define TILED_DIMS(nr_tasklets) ((nr_tasklets) > 16 ? 8 : 16)
+#define TILED_SLOT_BYTES(nr_tasklets) (TILED_DIMS(nr_tasklets) * sizeof(float) + 2 * MRAM_ALIGN)
+
+// WRAM the tiled path allocates: per tasklet the point and centroid slots, the
+// dequantized chunk of uint16 points, the distances, best distances, labels
+// (width bytes each) and bounds of a block and the scratch slot; shared the
+// zeros the MRAM accumulators are cleared from and the dequantization tables.
+// A macro so that dpu.c can check its worst case at compile time.
+#define TILED_WRAM_BYTES(nr_tasklets, dims, width, uint16, bounds)                                             \
+    (((TILE_POINTS + TILED_CENTROIDS(nr_tasklets) + 1) * TILED_SLOT_BYTES(nr_tasklets) +                       \
+      TILE_POINTS * TILED_CENTROIDS(nr_tasklets) * sizeof(float) + 2 * TILE_POINTS * sizeof(float) +           \
+      ALIGN8(TILE_POINTS * (width)) + ((uint16) ? TILE_POINTS * TILED_DIMS(nr_tasklets) * sizeof(float) : 0) + \
+      ((bounds) ? 2 * TILE_POINTS * sizeof(float) : 0)) * (nr_tasklets) +                                      \
+     MAX_DMA_BYTES + ((uint16) ? 2 * ALIGN8((dims) * sizeof(float)) : 0))
+
+// Per-DPU launch arguments
+typedef struct {
+    uint32_t nr_points;  // Real points in this DPU's shard
+    uint32_t nr_padded;  // Shard size after sentinel padding (same on every DPU)
+    uint32_t dims;
+    uint32_t k;
+    uint32_t mode;
+    uint32_t max_iterations;  // MODE_BATCH only
+    uint32_t format;          // enum point_format
+    uint32_t tile_points;     // Points per tile_bounds box, 0 without boxes
+    uint32_t want_distances;  // MODE_PREDICT: also write the distances
+    uint32_t track_bounds;    // MODE_STEP: keep a lower bound per point for incremental jobs
+    uint32_t bounded_points;  // Points [0, bounded_points) have a valid bound and label
+    uint32_t first_point;     // MODE_GENERATE: dataset index of the shard's first point
+    uint32_t block_bytes;     // Size of the point blocks streamed into WRAM, 0 for BLOCK_BYTES
+    uint32_t reserved;
+} dpu_arguments_t;
+
+// Incremental jobs: how far the centroids moved since the assignment the
+// bounds refer to. A point's bound on its distance to any other centroid than
+// its own drops by the largest drift among those others.
+typedef struct {
+    float max;       // Largest drift, Euclidean
+    float second;    // Second largest, for the points owned by the centroid that moved most
+    uint32_t argmax;
+    uint32_t reserved;
+} dpu_drift_t;
+
+// Parts of a MODE_STEP launch timed separately: loading the arguments and
+// centroids, the assignment pass (with clearing the partials), and merging
+// the tasklet partials and writing them out
+enum dpu_phase { PHASE_SETUP, PHASE_ASSIGN, PHASE_REDUCE, NR_DPU_PHASES };
+
+// Per-DPU result of one MODE_STEP launch, next to partial_sums
+typedef struct {
+    double inertia;          // Sum over the shard of the squared distance to the closest centroid
+    uint64_t cycles;         // Length of the launch, from tasklet 0's cycle counter
+    uint64_t phase_cycles[NR_DPU_PHASES];  // The same cycles split per enum dpu_phase
+    uint32_t full_searches;  // Points compared with every centroid; the others kept their label by their bound
+    uint32_t reserved;
+} dpu_step_header_t;
+
+typedef struct {
+    dpu_step_header_t header;
+    uint32_t counts[MAX_K];
+} dpu_step_result_t;
+
+// Empty-cluster recovery: every tasklet of a MODE_STEP launch reports the point
+// of its slice farthest from its centroid, with its coordinates in row t of
+// far_coordinates (ALIGN8(dims * sizeof(float)) bytes apart). The host reads
+// them only when a cluster came out empty. Slots of missing tasklets, and of
+// tasklets whose points all sit on their centroid, have distance 0.
+#define MAX_FAR_POINTS 24  // Upper bound on NR_TASKLETS
+typedef struct {
+    float distance;  // Squared
+    uint32_t label;
+} dpu_far_point_t;
+
+// Result of one MODE_BATCH problem, read back in a single transfer
+typedef struct {
+    double inertia;  // Of the last assignment pass
+    uint32_t iterations;
+    uint32_t reserved;
+} dpu_batch_header_t;
+
+typedef struct {
+    dpu_batch_header_t header;
+    float centroids[MAX_CENTROID_FLOATS];
+} dpu_batch_result_t;
+
+// Synthetic datasets (MODE_GENERATE). The generator is counter-based: point p
+// only depends on the seed and p, so any DPU, tasklet or the host computes the
+// same coordinates for it, whatever the number of DPUs.
+typedef struct {
+    uint32_t seed;
+    uint32_t nr_clusters;
+    float spread;  // Standard deviation of the points around their cluster's center
+    uint32_t reserved;
+} dpu_generator_t;
+
+// 32-bit integer hash (lowbias32), a bijection with full avalanche
+static inline uint32_t hash32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// Uniform in [0, 1) from the top 24 bits of draw slot of a stream
+static inline float random_unit(uint32_t stream, uint32_t slot) {
+    return (hash32(stream + slot * 0x9e3779b9u) >> 8) * (1.0f / 16777216.0f);
+}
+
+// Point p picks its cluster uniformly; cluster centers are uniform in [0, 1)^dims
+// and the offsets approximately normal: the sum of four uniforms, centered and
+// scaled to unit variance, which needs neither log nor sqrt on the DPU
+static inline void generate_point(const dpu_generator_t *generator, uint32_t point, uint32_t dims, float *out) {
+    uint32_t key = hash32(generator->seed);
+    uint32_t stream = hash32(key ^ point);
+    uint32_t cluster = hash32(stream) % generator->nr_clusters;
+    uint32_t center = hash32(key + 1) ^ hash32(cluster);
+
+    for (uint32_t d = 0; d < dims; d++) {
+        float sum = random_unit(stream, 4 * d + 1) + random_unit(stream, 4 * d + 2) + random_unit(stream, 4 * d + 3) +
+                    random_unit(stream, 4 * d + 4);
+        out[d] = random_unit(center, d) + generator->spread * (sum - 2.0f) * 1.7320508f;
+    }
+}
+
+#endif
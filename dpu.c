@@ -1,150 +1,1036 @@
-#include <defs.h>
-#include <mram.h>
-#include <barrier.h>
-#include <stdio.h>
-#include <stdlib.h>
-
-#define N_POINTS 10000  // Number of points
-#define DIMENSIONS 2
-#define K 6            // Number of clusters
-#define MAX_ITERATIONS 15
-
-__mram_noinit float points[N_POINTS][DIMENSIONS];
-__mram_noinit float centroids[K][DIMENSIONS];
-__mram_noinit int clusters[N_POINTS];
-
-BARRIER_INIT(my_barrier, NR_TASKLETS);
-
-// Simple Linear Congruential Generator (LCG)
-static unsigned long next = 1;
-int my_rand(void) {
-    next = next * 1103515245 + 12345;
-    return (unsigned int)(next / 65536) % 32768;
-}
-
-// Simple function to calculate square root using Newton's method
-float sqrt_approx(float number) {
-    float x = number;
-    float y = 1.0;
-    float e = 0.01;  // error threshold
-
-    while (x - y > e) {
-        x = (x + y) / 2;
-        y = number / x;
-    }
-    return x;
-}
-
-// Generate simple clusters around predefined centroids
-void generate_simple_clusters() {
-    float predefined_centroids[K][DIMENSIONS] = {
-        {1.0, 1.0},  // Centroid for cluster 1
-        {5.0, 5.0},  // Centroid for cluster 2
-        {9.0, 9.0},  // Centroid for cluster 3
-        {13.0, 13.0},// Centroid for cluster 4
-        {17.0, 17.0},// Centroid for cluster 5
-        {21.0, 21.0} // Centroid for cluster 6
-    };
-
-    int points_per_cluster = N_POINTS / K;
-
-    for (int i = 0; i < K; i++) {
-        for (int j = 0; j < points_per_cluster; j++) {
-            int index = i * points_per_cluster + j;
-            for (int d = 0; d < DIMENSIONS; d++) {
-                points[index][d] = predefined_centroids[i][d] + (float)(my_rand() % 100) / 1000.0;  // Small random variation
-            }
-        }
-    }
-}
-
-// K-means clustering functions (assign clusters and update centroids)
-void assign_clusters() {
-    for (int i = 0; i < N_POINTS; i++) {
-        float min_distance = 1e30;
-        int closest_centroid = 0;
-        for (int j = 0; j < K; j++) {
-            float distance = 0.0;
-            for (int d = 0; d < DIMENSIONS; d++) {
-                float diff = points[i][d] - centroids[j][d];
-                distance += diff * diff;
-            }
-            distance = sqrt_approx(distance);
-            if (distance < min_distance) {
-                min_distance = distance;
-                closest_centroid = j;
-            }
-        }
-        clusters[i] = closest_centroid;
-    }
-}
-
-void update_centroids() {
-    float new_centroids[K][DIMENSIONS] = {0};
-    int count[K] = {0};
-
-    for (int i = 0; i < N_POINTS; i++) {
-        int cluster_id = clusters[i];
-        for (int d = 0; d < DIMENSIONS; d++) {
-            new_centroids[cluster_id][d] += points[i][d];
-        }
-        count[cluster_id]++;
-    }
-
-    for (int j = 0; j < K; j++) {
-        if (count[j] != 0) {
-            for (int d = 0; d < DIMENSIONS; d++) {
-                centroids[j][d] = new_centroids[j][d] / count[j];
-            }
-        }
-    }
-}
-
-// Function to print centroids
-void print_centroids(const char* title) {
-    printf("%s:\n", title);
-    for (int i = 0; i < K; i++) {
-        printf("Centroid %d: (", i);
-        for (int j = 0; j < DIMENSIONS; j++) {
-            printf("%f", centroids[i][j]);
-            if (j < DIMENSIONS - 1) printf(", ");
-        }
-        printf(")\n");
-    }
-}
-
-int main() {
-    // Generate simple clusters
-    generate_simple_clusters();
-
-    // Initialize centroids randomly from points
-    for (int i = 0; i < K; i++) {
-        for (int j = 0; j < DIMENSIONS; j++) {
-            centroids[i][j] = points[my_rand() % N_POINTS][j];
-        }
-    }
-
-    barrier_wait(&my_barrier);
-
-    // Print initial centroids
-    print_centroids("Initial Centroids");
-
-    // Perform K-means clustering
-    for (int iteration = 0; iteration < MAX_ITERATIONS; iteration++) {
-        printf("\nIteration %d:\n", iteration + 1);
-
-        assign_clusters();
-        barrier_wait(&my_barrier);
-
-        update_centroids();
-        barrier_wait(&my_barrier);
-
-        // Print centroids after update
-        print_centroids("Updated Centroids");
-    }
-
-    // Print final centroids
-    print_centroids("Final Centroids");
-
-    return 0;
-}
+#include <defs.h>
+#include <mram.h>
+#include <alloc.h>
+#include <barrier.h>
+#include <perfcounter.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+
+// MODE_STEP: one launch = one Lloyd iteration over this DPU's shard. The host
+// broadcasts the centroids, every tasklet assigns its slice of the shard and
+// accumulates per-cluster partial sums, and the host merges the partials of all DPUs.
+// MODE_BATCH: the shard is a small independent problem; the DPU runs all of its
+// iterations from the initial centroids the host wrote and returns the result.
+// MODE_PREDICT: the centroids the host loaded once stay in MRAM across launches;
+// each launch only labels a new shard, optionally with the squared distances.
+// MODE_GENERATE: every tasklet fills its slice of the shard with synthetic
+// points, so large benchmarks need no host transfer at all.
+// Incremental MODE_STEP jobs keep, next to each label, a lower bound on the
+// distance to every other centroid (Hamerly): a point whose own centroid is
+// still closer than that bound, lowered by how far the centroids moved, keeps
+// its label after a single distance computation. In tiled mode, a block whose
+// points all keep their labels skips the centroid stream altogether.
+// Every tasklet also keeps the point of its slice farthest from its centroid:
+// MODE_STEP publishes them for the host to move empty clusters onto, MODE_BATCH
+// (untiled) moves its empty clusters onto them before updating the centroids.
+//
+// When the centroids and the per-tasklet accumulators do not fit in WRAM (large
+// D or K), the kernel runs tiled: centroids stay in MRAM and stream through WRAM
+// in blocks of TILE_CENTROIDS x TILE_DIMS against blocks of TILE_POINTS points,
+// with a running best distance and label per point, and the partial sums
+// accumulate in per-tasklet MRAM regions. Tile pruning is skipped in that case.
+// Above 16 tasklets the centroid and dimension chunks are halved, so the tile
+// buffers of all tasklets fit in the smaller heap whatever D and K.
+
+// Tiled blocking: each centroid chunk read is reused for TILE_POINTS points and
+// each point chunk for TILE_CENTROIDS centroids (see common.h for the sizes)
+#define TILE_CENTROIDS TILED_CENTROIDS(NR_TASKLETS)
+#define TILE_DIMS TILED_DIMS(NR_TASKLETS)
+#define SLOT_BYTES TILED_SLOT_BYTES(NR_TASKLETS)  // One chunk and its alignment slack
+// Chunk of the tiled reduction, read into the centroid and point slots
+#define REDUCE_BYTES (TILE_CENTROIDS * SLOT_BYTES < 512 ? TILE_CENTROIDS * SLOT_BYTES : 512)
+
+// Relative slack on the bounds, covering the float rounding of the distances
+// and of bound_sqrt
+#define BOUND_MARGIN 1e-4f
+
+// Heap left for the working set
+#define WRAM_HEAP_BYTES WRAM_HEAP(NR_TASKLETS)
+
+#if NR_TASKLETS > MAX_FAR_POINTS
+#error "NR_TASKLETS above MAX_FAR_POINTS: far_points has no slot for every tasklet"
+#endif
+
+// The tiled path is the fallback of every job, so its buffers must fit for any D and K
+_Static_assert(TILED_WRAM_BYTES(NR_TASKLETS, MAX_DIMENSIONS, MAX_LABEL_BYTES, 1, 1) <= WRAM_HEAP_BYTES,
+               "the tiled buffers do not fit in WRAM at this NR_TASKLETS");
+
+__host dpu_arguments_t DPU_INPUT_ARGUMENTS;
+__host dpu_drift_t bound_drift;
+__host dpu_generator_t generator;
+
+__mram_noinit dpu_quantization_t quantization;
+__mram_noinit float points[MAX_POINT_FLOATS];  // Or uint16 coordinates, see enum point_format
+__mram_noinit float centroids[MAX_CENTROID_FLOATS];
+__mram_noinit uint8_t clusters[MAX_POINTS_PER_DPU * MAX_LABEL_BYTES];  // label_bytes(k) per point
+__mram_noinit float partial_sums[MAX_CENTROID_FLOATS];
+__mram_noinit dpu_step_result_t step_result;
+__mram_noinit dpu_batch_result_t batch_result;
+__mram_noinit float tile_bounds[MAX_TILE_BOUND_FLOATS];
+__mram_noinit float nearest_distances[MAX_PREDICT_POINTS];  // MODE_PREDICT, squared
+__mram_noinit float lower_bounds[MAX_POINTS_PER_DPU];         // track_bounds, Euclidean
+__mram_noinit dpu_far_point_t far_points[MAX_FAR_POINTS];
+__mram_noinit float far_coordinates[MAX_FAR_POINTS * MAX_DIMENSIONS];
+// Tiled mode accumulators, one region per tasklet
+__mram_noinit float mram_sums[NR_TASKLETS * MAX_CENTROID_FLOATS];
+__mram_noinit uint32_t mram_counts[NR_TASKLETS * MAX_K];
+
+BARRIER_INIT(my_barrier, NR_TASKLETS);
+
+// WRAM copies shared between tasklets
+float *wram_centroids;
+float *tasklet_sums[NR_TASKLETS];
+uint32_t *tasklet_counts[NR_TASKLETS];
+double tasklet_inertia[NR_TASKLETS];
+double dpu_inertia;
+uint32_t tasklet_searches[NR_TASKLETS];
+uint32_t dpu_searches;
+int centroids_changed;
+int tiled;
+float *dequantize_offset;  // POINTS_UINT16: x[d] = offset[d] + scale[d] * q[d]
+float *dequantize_scale;
+uint8_t *zeros;            // Tiled mode: source for clearing the MRAM accumulators
+// Farthest point of every tasklet's slice in the last assignment pass
+float far_distance[NR_TASKLETS];  // Squared, 0 if none is off its centroid
+uint32_t far_label[NR_TASKLETS];
+uint32_t far_index[NR_TASKLETS];  // Tiled mode
+float *far_point[NR_TASKLETS];    // Untiled mode: its coordinates
+
+// Tiled-mode WRAM buffers of one tasklet
+typedef struct {
+    float *point_values[TILE_POINTS];  // Current chunk of each point of the block
+    float *centroid_values[TILE_CENTROIDS];
+    uint8_t *point_slots;     // TILE_POINTS x SLOT_BYTES
+    uint8_t *centroid_slots;  // TILE_CENTROIDS x SLOT_BYTES
+    float *dequantized;       // TILE_POINTS x TILE_DIMS, POINTS_UINT16 only
+    float *distances;         // TILE_POINTS x TILE_CENTROIDS, summed over the dimension chunks
+    float *best;              // Running best distance and label of each point of the block
+    float *second;            // track_bounds: running second best distance
+    float *lower;             // track_bounds: bounds of the block
+    uint32_t *best_label;
+    uint8_t *labels;
+    uint8_t *scratch;         // SLOT_BYTES, read-modify-write of the accumulators
+} tile_buffers_t;
+
+// Copy a region of any 8-byte multiple size in DMA-sized chunks
+void mram_read_large(__mram_ptr void *from, void *to, uint32_t bytes) {
+    for (uint32_t off = 0; off < bytes; off += MAX_DMA_BYTES) {
+        uint32_t chunk = bytes - off < MAX_DMA_BYTES ? bytes - off : MAX_DMA_BYTES;
+        mram_read((__mram_ptr uint8_t *)from + off, (uint8_t *)to + off, chunk);
+    }
+}
+
+void mram_write_large(const void *from, __mram_ptr void *to, uint32_t bytes) {
+    for (uint32_t off = 0; off < bytes; off += MAX_DMA_BYTES) {
+        uint32_t chunk = bytes - off < MAX_DMA_BYTES ? bytes - off : MAX_DMA_BYTES;
+        mram_write((const uint8_t *)from + off, (__mram_ptr uint8_t *)to + off, chunk);
+    }
+}
+
+// Read bytes at any MRAM address: the DMA covers the enclosing 8-byte aligned
+// range into scratch and the returned pointer skips the leading bytes
+void *mram_read_unaligned(__mram_ptr uint8_t *from, uint8_t *scratch, uint32_t bytes) {
+    uint32_t shift = (uintptr_t)from & (MRAM_ALIGN - 1);
+    mram_read_large(from - shift, scratch, ALIGN8(shift + bytes));
+    return scratch + shift;
+}
+
+// Write back the range read by mram_read_unaligned; the bytes around the
+// requested ones are rewritten too, so no other tasklet may write them meanwhile
+void mram_write_unaligned(const uint8_t *scratch, __mram_ptr uint8_t *to, uint32_t bytes) {
+    uint32_t shift = (uintptr_t)to & (MRAM_ALIGN - 1);
+    mram_write_large(scratch, to - shift, ALIGN8(shift + bytes));
+}
+
+// Read n points starting at index base into block as floats. uint16 points go
+// through the packed buffer and are widened once per block, so the distance
+// loop always runs in float.
+void read_points(uint32_t base, uint32_t n, float *block, uint16_t *packed) {
+    uint32_t dims = DPU_INPUT_ARGUMENTS.dims;
+    uint32_t count = n * dims;
+
+    if (DPU_INPUT_ARGUMENTS.format == POINTS_UINT16) {
+        mram_read_large((__mram_ptr uint8_t *)points + base * dims * sizeof(uint16_t), packed, count * sizeof(uint16_t));
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t d = i % dims;
+            block[i] = dequantize_offset[d] + dequantize_scale[d] * packed[i];
+        }
+    } else {
+        mram_read_large(&points[base * dims], block, count * sizeof(float));
+    }
+}
+
+// Tiled mode: read n coordinates of one point from coordinate index first on,
+// as floats. uint16 coordinates are widened into out.
+float *read_coordinates(uint32_t first, uint32_t n, float *out, uint8_t *slot) {
+    uint32_t dims = DPU_INPUT_ARGUMENTS.dims;
+
+    if (DPU_INPUT_ARGUMENTS.format == POINTS_UINT16) {
+        uint16_t *packed = mram_read_unaligned((__mram_ptr uint8_t *)points + first * sizeof(uint16_t), slot,
+                                               n * sizeof(uint16_t));
+        for (uint32_t i = 0; i < n; i++) {
+            uint32_t d = (first + i) % dims;
+            out[i] = dequantize_offset[d] + dequantize_scale[d] * packed[i];
+        }
+        return out;
+    }
+    return mram_read_unaligned((__mram_ptr uint8_t *)&points[first], slot, n * sizeof(float));
+}
+
+// Whether the centroids and every tasklet's accumulators and point blocks fit
+// in WRAM next to each other; otherwise the kernel runs tiled
+int fits_in_wram(void) {
+    uint32_t dims = DPU_INPUT_ARGUMENTS.dims;
+    uint32_t k = DPU_INPUT_ARGUMENTS.k;
+    uint32_t per_block = points_per_block(dims, DPU_INPUT_ARGUMENTS.block_bytes);
+    uint32_t sums_bytes = ALIGN8(k * dims * sizeof(float));
+    uint32_t per_tasklet = per_block * dims * sizeof(float) + ALIGN8(per_block * label_bytes(k)) +
+                           ALIGN8(k * sizeof(uint16_t));
+    uint32_t shared = sums_bytes;  // The centroids, and the dequantization tables of uint16 points
+
+    if (DPU_INPUT_ARGUMENTS.mode == MODE_PREDICT) {
+        per_tasklet += DPU_INPUT_ARGUMENTS.want_distances ? per_block * sizeof(float) : 0;
+    } else {
+        per_tasklet += sums_bytes + ALIGN8(k * sizeof(uint32_t)) + ALIGN8(dims * sizeof(float));
+        per_tasklet += DPU_INPUT_ARGUMENTS.track_bounds ? per_block * sizeof(float) : 0;
+    }
+
+    if (DPU_INPUT_ARGUMENTS.format == POINTS_UINT16) {
+        per_tasklet += per_block * dims * sizeof(uint16_t);
+        shared += 2 * ALIGN8(dims * sizeof(float));
+    }
+    if (DPU_INPUT_ARGUMENTS.tile_points) {
+        per_tasklet += 2 * dims * sizeof(float);
+    }
+    return (uint64_t)per_tasklet * NR_TASKLETS + shared <= WRAM_HEAP_BYTES;
+}
+
+// MODE_GENERATE: tasklets that get at least two points of heap each write
+// their slice of the shard, up to the alignment tail of the last one, in
+// blocks of an even number of points so every write stays 8-byte aligned
+void generate_points(uint32_t tasklet_id) {
+    uint32_t nr_points = DPU_INPUT_ARGUMENTS.nr_points;
+    uint32_t dims = DPU_INPUT_ARGUMENTS.dims;
+    uint32_t point_bytes = dims * sizeof(float);
+    uint32_t active = WRAM_HEAP_BYTES / (2 * point_bytes);
+    uint32_t per_block, first, last;
+    float *block;
+
+    active = active < NR_TASKLETS ? active : NR_TASKLETS;
+    if (tasklet_id >= active) {
+        return;
+    }
+    per_block = WRAM_HEAP_BYTES / active / point_bytes;
+    per_block = per_block >= SHARD_ALIGN ? per_block / SHARD_ALIGN * SHARD_ALIGN : 2;
+    block = mem_alloc(per_block * point_bytes);
+
+    first = (uint32_t)((uint64_t)nr_points * tasklet_id / active) / SHARD_ALIGN * SHARD_ALIGN;
+    last = (uint32_t)((uint64_t)nr_points * (tasklet_id + 1) / active) / SHARD_ALIGN * SHARD_ALIGN;
+    if (tasklet_id == active - 1) {
+        last = ALIGN_UP(nr_points, SHARD_ALIGN);
+    }
+
+    for (uint32_t base = first; base < last; base += per_block) {
+        uint32_t n = last - base < per_block ? last - base : per_block;
+        for (uint32_t i = 0; i < n; i++) {
+            generate_point(&generator, DPU_INPUT_ARGUMENTS.first_point + base + i, dims, &block[i * dims]);
+        }
+        mram_write_large(block, &points[base * dims], n * point_bytes);
+    }
+}
+
+// Square root for the bounds, without libm: Newton steps from a first guess
+// halving the float exponent, well within BOUND_MARGIN after three steps
+float bound_sqrt(float x) {
+    union {
+        float f;
+        uint32_t i;
+    } guess = {x};
+
+    if (x <= 0.0f) {
+        return 0.0f;
+    }
+    guess.i = 0x1fbd1df5 + (guess.i >> 1);
+    float y = guess.f;
+    for (uint32_t step = 0; step < 3; step++) {
+        y = 0.5f * (y + x / y);
+    }
+    return y;
+}
+
+// Keep only the centroids that can be closest to some point of the box: a
+// centroid whose nearest corner is farther than the far corner of another
+// centroid never wins. Candidates stay in index order, so ties resolve as without pruning.
+uint32_t prune_centroids(const float *box, uint16_t *candidates) {
+    uint32_t dims = DPU_INPUT_ARGUMENTS.dims;
+    uint32_t k = DPU_INPUT_ARGUMENTS.k;
+    const float *low = box, *high = box + dims;
+    float bound = 1e30;
+    uint32_t n = 0;
+
+    for (uint32_t j = 0; j < k; j++) {
+        float *c = &wram_centroids[j * dims];
+        float far = 0.0;
+        for (uint32_t d = 0; d < dims; d++) {
+            float a = c[d] - low[d], b = c[d] - high[d];
+            far += a * a > b * b ? a * a : b * b;
+        }
+        bound = far < bound ? far : bound;
+    }
+    // Slack for the rounding of the float sums
+    bound += bound * 1e-5f;
+    for (uint32_t j = 0; j < k; j++) {
+        float *c = &wram_centroids[j * dims];
+        float near = 0.0;
+        for (uint32_t d = 0; d < dims; d++) {
+            float gap = c[d] < low[d] ? low[d] - c[d] : c[d] > high[d] ? c[d] - high[d] : 0.0f;
+            near += gap * gap;
+        }
+        if (near <= bound) {
+            candidates[n++] = j;
+        }
+    }
+    return n;
+}
+
+// Assign every point of this tasklet's slice to its closest centroid and
+// accumulate the slice's per-cluster sums and inertia in the same pass.
+// With tile boxes, each block is one tile and only its candidate centroids are scanned.
+// MODE_PREDICT skips the sums and keeps the distances in nearest if not NULL.
+// With lower (track_bounds), points below bounded_points first try their previous label.
+void assign_clusters(uint32_t tasklet_id, float *block, uint16_t *packed, uint8_t *labels, float *box,
+                     uint16_t *candidates, float *nearest, float *lower) {
+    uint32_t nr_points = DPU_INPUT_ARGUMENTS.nr_points;
+    uint32_t dims = DPU_INPUT_ARGUMENTS.dims;
+    uint32_t k = DPU_INPUT_ARGUMENTS.k;
+    uint32_t tile_points = DPU_INPUT_ARGUMENTS.tile_points;
+    uint32_t width = label_bytes(k);
+    uint32_t per_block = tile_points ? tile_points : points_per_block(dims, DPU_INPUT_ARGUMENTS.block_bytes);
+    uint32_t align = tile_points ? tile_points : SHARD_ALIGN;
+    uint32_t bounded = lower ? DPU_INPUT_ARGUMENTS.bounded_points : 0;
+    int predict = DPU_INPUT_ARGUMENTS.mode == MODE_PREDICT;
+    float *sums = tasklet_sums[tasklet_id];
+    uint32_t *counts = tasklet_counts[tasklet_id];
+
+    // Even split of the real points, so no tasklet idles on sentinel padding
+    uint32_t first = (uint32_t)((uint64_t)nr_points * tasklet_id / NR_TASKLETS) / align * align;
+    uint32_t last = (uint32_t)((uint64_t)nr_points * (tasklet_id + 1) / NR_TASKLETS) / align * align;
+    if (tasklet_id == NR_TASKLETS - 1) {
+        last = nr_points;
+    }
+    double inertia = 0.0;
+    uint32_t nr_candidates = k;
+    uint32_t searches = 0;
+    float far = 0.0f;
+    uint32_t far_cluster = 0;
+
+    for (uint32_t j = 0; j < k; j++) {
+        candidates[j] = j;
+    }
+
+    for (uint32_t base = first; base < last; base += per_block) {
+        uint32_t n = last - base < per_block ? last - base : per_block;
+        // Read up to the next aligned point; the tail is sentinel padding and is not used
+        uint32_t n_aligned = ALIGN_UP(n, SHARD_ALIGN);
+        read_points(base, n_aligned, block, packed);
+        if (tile_points) {
+            mram_read(&tile_bounds[base / tile_points * 2 * dims], box, 2 * dims * sizeof(float));
+            nr_candidates = prune_centroids(box, candidates);
+        }
+        if (lower) {
+            mram_read_large(&lower_bounds[base], lower, n_aligned * sizeof(float));
+            mram_read_large(&clusters[base * width], labels, n_aligned * width);
+        }
+
+        // Summed per block in float, across blocks in double
+        float block_inertia = 0.0;
+        for (uint32_t i = 0; i < n; i++) {
+            float *p = &block[i * dims];
+            float min_distance = 1e30, second_distance = 1e30;
+            int closest_centroid = 0;
+            int search = 1;
+            if (base + i < bounded) {
+                // Every other centroid is at least bound away: if the previous
+                // one is strictly closer, it is still the (unique) closest
+                uint32_t previous = width == 1 ? labels[i] : ((uint16_t *)labels)[i];
+                float bound = lower[i] - (previous == bound_drift.argmax ? bound_drift.second : bound_drift.max);
+                float *c = &wram_centroids[previous * dims];
+                float distance = 0.0;
+                for (uint32_t d = 0; d < dims; d++) {
+                    float diff = p[d] - c[d];
+                    distance += diff * diff;
+                }
+                if (bound > 0.0f && distance * (1.0f + BOUND_MARGIN) < bound * bound) {
+                    min_distance = distance;
+                    closest_centroid = previous;
+                    lower[i] = bound;
+                    search = 0;
+                }
+            }
+            if (search) {
+                for (uint32_t c_index = 0; c_index < nr_candidates; c_index++) {
+                    uint32_t j = candidates[c_index];
+                    float *c = &wram_centroids[j * dims];
+                    float distance = 0.0;
+                    for (uint32_t d = 0; d < dims; d++) {
+                        float diff = p[d] - c[d];
+                        distance += diff * diff;
+                    }
+                    // Squared distance has the same argmin, no square root needed
+                    if (distance < min_distance) {
+                        second_distance = min_distance;
+                        min_distance = distance;
+                        closest_centroid = j;
+                    } else if (distance < second_distance) {
+                        second_distance = distance;
+                    }
+                }
+                if (lower) {
+                    lower[i] = bound_sqrt(second_distance) * (1.0f - BOUND_MARGIN);
+                }
+                searches++;
+            }
+            if (width == 1) {
+                labels[i] = closest_centroid;
+            } else {
+                ((uint16_t *)labels)[i] = closest_centroid;
+            }
+            block_inertia += min_distance;
+            if (predict) {
+                if (nearest) {
+                    nearest[i] = min_distance;
+                }
+                continue;
+            }
+            for (uint32_t d = 0; d < dims; d++) {
+                sums[closest_centroid * dims + d] += p[d];
+            }
+            counts[closest_centroid]++;
+            if (min_distance > far) {
+                far = min_distance;
+                far_cluster = closest_centroid;
+                for (uint32_t d = 0; d < dims; d++) {
+                    far_point[tasklet_id][d] = p[d];
+                }
+            }
+        }
+        // Labels of the sentinel tail are ignored by the host
+        for (uint32_t i = n * width; i < n_aligned * width; i++) {
+            labels[i] = 0xff;
+        }
+
+        mram_write_large(labels, &clusters[base * width], n_aligned * width);
+        if (lower) {
+            mram_write_large(lower, &lower_bounds[base], n_aligned * sizeof(float));
+        }
+        if (nearest) {
+            mram_write_large(nearest, &nearest_distances[base], n_aligned * sizeof(float));
+        }
+        inertia += block_inertia;
+    }
+
+    tasklet_inertia[tasklet_id] = inertia;
+    tasklet_searches[tasklet_id] = searches;
+    far_distance[tasklet_id] = far;
+    far_label[tasklet_id] = far_cluster;
+}
+
+// Parallel reduction: each tasklet folds one slice of every tasklet's
+// accumulators into tasklet 0's buffers
+void reduce_partials(uint32_t tasklet_id) {
+    uint32_t k = DPU_INPUT_ARGUMENTS.k;
+    uint32_t len = k * DPU_INPUT_ARGUMENTS.dims;
+
+    for (uint32_t i = tasklet_id; i < len; i += NR_TASKLETS) {
+        for (uint32_t t = 1; t < NR_TASKLETS; t++) {
+            tasklet_sums[0][i] += tasklet_sums[t][i];
+        }
+    }
+    for (uint32_t j = tasklet_id; j < k; j += NR_TASKLETS) {
+        for (uint32_t t = 1; t < NR_TASKLETS; t++) {
+            tasklet_counts[0][j] += tasklet_counts[t][j];
+        }
+    }
+    if (tasklet_id == 0) {
+        dpu_inertia = 0.0;
+        dpu_searches = 0;
+        for (uint32_t t = 0; t < NR_TASKLETS; t++) {
+            dpu_inertia += tasklet_inertia[t];
+            dpu_searches += tasklet_searches[t];
+        }
+    }
+}
+
+// MODE_BATCH: move every non-empty centroid to its mean, on a strided subset of clusters
+void update_centroids(uint32_t tasklet_id) {
+    uint32_t dims = DPU_INPUT_ARGUMENTS.dims;
+
+    for (uint32_t j = tasklet_id; j < DPU_INPUT_ARGUMENTS.k; j += NR_TASKLETS) {
+        uint32_t count = tasklet_counts[0][j];
+        if (count != 0) {
+            for (uint32_t d = 0; d < dims; d++) {
+                float centroid = tasklet_sums[0][j * dims + d] / count;
+                if (centroid != wram_centroids[j * dims + d]) {
+                    wram_centroids[j * dims + d] = centroid;
+                    centroids_changed = 1;
+                }
+            }
+        }
+    }
+}
+
+// MODE_STEP: write this tasklet's farthest point to its far_points slot; tasklet
+// 0 also clears the slots no tasklet owns. Tiled mode reads the point back
+// from MRAM chunk by chunk, through the centroid slots.
+void store_far_point(uint32_t tasklet_id, tile_buffers_t *buffers) {
+    uint32_t dims = DPU_INPUT_ARGUMENTS.dims;
+    uint32_t stride = ALIGN8(dims * sizeof(float)) / sizeof(float);
+    __mram_ptr float *row = &far_coordinates[tasklet_id * stride];
+    __dma_aligned dpu_far_point_t far = {far_distance[tasklet_id], far_label[tasklet_id]};
+
+    mram_write(&far, &far_points[tasklet_id], sizeof(far));
+    if (tasklet_id == 0) {
+        __dma_aligned dpu_far_point_t none = {0.0f, 0};
+        for (uint32_t t = NR_TASKLETS; t < MAX_FAR_POINTS; t++) {
+            mram_write(&none, &far_points[t], sizeof(none));
+        }
+    }
+    if (far.distance <= 0.0f) {
+        return;
+    }
+    if (!buffers) {
+        mram_write_large(far_point[tasklet_id], row, stride * sizeof(float));
+        return;
+    }
+    for (uint32_t d0 = 0; d0 < dims; d0 += TILE_DIMS) {
+        uint32_t nd = dims - d0 < TILE_DIMS ? dims - d0 : TILE_DIMS;
+        float *aligned = (float *)buffers->centroid_slots;
+        float *x = read_coordinates(far_index[tasklet_id] * dims + d0, nd, aligned, buffers->point_slots);
+        for (uint32_t d = 0; d < nd && x != aligned; d++) {
+            aligned[d] = x[d];
+        }
+        mram_write(aligned, (__mram_ptr uint8_t *)&row[d0], ALIGN8(nd * sizeof(float)));
+    }
+}
+
+// Untiled MODE_BATCH, tasklet 0 between the reduction and the update: move
+// every empty cluster onto the farthest unused tasklet point whose cluster
+// keeps other points, taking the point out of that cluster
+void relocate_empty_clusters(void) {
+    uint32_t dims = DPU_INPUT_ARGUMENTS.dims;
+    float *sums = tasklet_sums[0];
+    uint32_t *counts = tasklet_counts[0];
+    uint32_t used = 0;  // One bit per tasklet
+
+    for (uint32_t j = 0; j < DPU_INPUT_ARGUMENTS.k; j++) {
+        int best = -1;
+        if (counts[j] != 0) {
+            continue;
+        }
+        for (uint32_t t = 0; t < NR_TASKLETS; t++) {
+            if (!(used & (1u << t)) && far_distance[t] > 0.0f && counts[far_label[t]] > 1 &&
+                (best < 0 || far_distance[t] > far_distance[best])) {
+                best = t;
+            }
+        }
+        if (best < 0) {
+            return;
+        }
+        used |= 1u << best;
+        for (uint32_t d = 0; d < dims; d++) {
+            sums[far_label[best] * dims + d] -= far_point[best][d];
+            sums[j * dims + d] = far_point[best][d];
+        }
+        counts[far_label[best]]--;
+        counts[j] = 1;
+    }
+}
+
+// Tiled mode: squared distance of point base + p to centroid j, streamed chunk
+// by chunk in the order of the full scan. With a single chunk, the point stays
+// in point_values[p] for the accumulation.
+float tiled_distance(tile_buffers_t *buffers, uint32_t base, uint32_t p, uint32_t j) {
+    uint32_t dims = DPU_INPUT_ARGUMENTS.dims;
+    float distance = 0.0;
+
+    for (uint32_t d0 = 0; d0 < dims; d0 += TILE_DIMS) {
+        uint32_t nd = dims - d0 < TILE_DIMS ? dims - d0 : TILE_DIMS;
+        float *x = read_coordinates((base + p) * dims + d0, nd, &buffers->dequantized[p * TILE_DIMS],
+                                    &buffers->point_slots[p * SLOT_BYTES]);
+        float *y = mram_read_unaligned((__mram_ptr uint8_t *)&centroids[j * dims + d0], buffers->centroid_slots,
+                                       nd * sizeof(float));
+        for (uint32_t d = 0; d < nd; d++) {
+            float diff = x[d] - y[d];
+            distance += diff * diff;
+        }
+        buffers->point_values[p] = x;
+    }
+    return distance;
+}
+
+// Tiled mode: assign the slice in blocks of TILE_POINTS points. For each block,
+// the centroids stream through WRAM TILE_CENTROIDS at a time and the dimensions
+// TILE_DIMS at a time, the squared distances are summed in the same order as in
+// assign_clusters, and each point keeps its best distance and label so far.
+void assign_tiled(uint32_t tasklet_id, tile_buffers_t *buffers) {
+    uint32_t nr_points = DPU_INPUT_ARGUMENTS.nr_points;
+    uint32_t dims = DPU_INPUT_ARGUMENTS.dims;
+    uint32_t k = DPU_INPUT_ARGUMENTS.k;
+    uint32_t width = label_bytes(k);
+    uint32_t align = DPU_INPUT_ARGUMENTS.tile_points ? DPU_INPUT_ARGUMENTS.tile_points : SHARD_ALIGN;
+    uint32_t nr_chunks = (dims + TILE_DIMS - 1) / TILE_DIMS;
+    __mram_ptr float *sums = &mram_sums[tasklet_id * MAX_CENTROID_FLOATS];
+    __mram_ptr uint32_t *counts = &mram_counts[tasklet_id * MAX_K];
+    float *distances = buffers->distances;
+    uint32_t bounded = buffers->lower ? DPU_INPUT_ARGUMENTS.bounded_points : 0;
+    uint32_t searches = 0;
+    float far = 0.0f;
+    uint32_t far_cluster = 0, far_point_index = 0;
+
+    uint32_t first = (uint32_t)((uint64_t)nr_points * tasklet_id / NR_TASKLETS) / align * align;
+    uint32_t last = (uint32_t)((uint64_t)nr_points * (tasklet_id + 1) / NR_TASKLETS) / align * align;
+    if (tasklet_id == NR_TASKLETS - 1) {
+        last = nr_points;
+    }
+    double inertia = 0.0;
+
+    for (uint32_t base = first; base < last; base += TILE_POINTS) {
+        uint32_t n = last - base < TILE_POINTS ? last - base : TILE_POINTS;
+        uint8_t search[TILE_POINTS];
+        uint32_t nr_search = n;
+
+        if (buffers->lower) {
+            mram_read(&lower_bounds[base], buffers->lower, TILE_POINTS * sizeof(float));
+            mram_read(&clusters[base * width], buffers->labels, TILE_POINTS * width);
+        }
+        for (uint32_t p = 0; p < n; p++) {
+            buffers->best[p] = 1e30;
+            buffers->best_label[p] = 0;
+            search[p] = 1;
+            if (base + p < bounded) {
+                // Same test as in assign_clusters
+                uint32_t previous = width == 1 ? buffers->labels[p] : ((uint16_t *)buffers->labels)[p];
+                float bound = buffers->lower[p] -
+                              (previous == bound_drift.argmax ? bound_drift.second : bound_drift.max);
+                float distance = tiled_distance(buffers, base, p, previous);
+                if (bound > 0.0f && distance * (1.0f + BOUND_MARGIN) < bound * bound) {
+                    buffers->best[p] = distance;
+                    buffers->best_label[p] = previous;
+                    buffers->lower[p] = bound;
+                    search[p] = 0;
+                    nr_search--;
+                }
+            }
+            if (buffers->lower) {
+                buffers->second[p] = 1e30;
+            }
+        }
+        searches += nr_search;
+
+        for (uint32_t j0 = 0; j0 < k && nr_search > 0; j0 += TILE_CENTROIDS) {
+            uint32_t nc = k - j0 < TILE_CENTROIDS ? k - j0 : TILE_CENTROIDS;
+
+            for (uint32_t i = 0; i < n * TILE_CENTROIDS; i++) {
+                distances[i] = 0.0;
+            }
+            for (uint32_t d0 = 0; d0 < dims; d0 += TILE_DIMS) {
+                uint32_t nd = dims - d0 < TILE_DIMS ? dims - d0 : TILE_DIMS;
+
+                // With a single chunk, the points stay in WRAM across all centroid blocks
+                if (nr_chunks > 1 || j0 == 0) {
+                    for (uint32_t p = 0; p < n; p++) {
+                        buffers->point_values[p] = read_coordinates((base + p) * dims + d0, nd,
+                                                                    &buffers->dequantized[p * TILE_DIMS],
+                                                                    &buffers->point_slots[p * SLOT_BYTES]);
+                    }
+                }
+                for (uint32_t c = 0; c < nc; c++) {
+                    buffers->centroid_values[c] = mram_read_unaligned(
+                        (__mram_ptr uint8_t *)&centroids[(j0 + c) * dims + d0], &buffers->centroid_slots[c * SLOT_BYTES],
+                        nd * sizeof(float));
+                }
+                for (uint32_t p = 0; p < n; p++) {
+                    float *x = buffers->point_values[p];
+                    if (!search[p]) {
+                        continue;
+                    }
+                    for (uint32_t c = 0; c < nc; c++) {
+                        float *y = buffers->centroid_values[c];
+                        float distance = distances[p * TILE_CENTROIDS + c];
+                        for (uint32_t d = 0; d < nd; d++) {
+                            float diff = x[d] - y[d];
+                            distance += diff * diff;
+                        }
+                        distances[p * TILE_CENTROIDS + c] = distance;
+                    }
+                }
+            }
+            // Blocks come in index order, so ties resolve as in assign_clusters
+            for (uint32_t p = 0; p < n; p++) {
+                for (uint32_t c = 0; c < nc && search[p]; c++) {
+                    float distance = distances[p * TILE_CENTROIDS + c];
+                    if (distance < buffers->best[p]) {
+                        if (buffers->lower) {
+                            buffers->second[p] = buffers->best[p];
+                        }
+                        buffers->best[p] = distance;
+                        buffers->best_label[p] = j0 + c;
+                    } else if (buffers->lower && distance < buffers->second[p]) {
+                        buffers->second[p] = distance;
+                    }
+                }
+            }
+        }
+        if (buffers->lower) {
+            for (uint32_t p = 0; p < n; p++) {
+                if (search[p]) {
+                    buffers->lower[p] = bound_sqrt(buffers->second[p]) * (1.0f - BOUND_MARGIN);
+                }
+            }
+            mram_write(buffers->lower, &lower_bounds[base], TILE_POINTS * sizeof(float));
+        }
+
+        float block_inertia = 0.0;
+        for (uint32_t p = 0; p < n; p++) {
+            if (width == 1) {
+                buffers->labels[p] = buffers->best_label[p];
+            } else {
+                ((uint16_t *)buffers->labels)[p] = buffers->best_label[p];
+            }
+            block_inertia += buffers->best[p];
+        }
+        for (uint32_t i = n * width; i < TILE_POINTS * width; i++) {
+            buffers->labels[i] = 0xff;
+        }
+        mram_write(buffers->labels, &clusters[base * width], TILE_POINTS * width);
+        inertia += block_inertia;
+        if (DPU_INPUT_ARGUMENTS.mode == MODE_PREDICT) {
+            if (DPU_INPUT_ARGUMENTS.want_distances) {
+                mram_write(buffers->best, &nearest_distances[base], TILE_POINTS * sizeof(float));
+            }
+            continue;
+        }
+
+        // Add every point to its cluster's row in this tasklet's MRAM accumulator
+        for (uint32_t p = 0; p < n; p++) {
+            uint32_t j = buffers->best_label[p];
+            if (buffers->best[p] > far) {
+                far = buffers->best[p];
+                far_cluster = j;
+                far_point_index = base + p;
+            }
+            for (uint32_t d0 = 0; d0 < dims; d0 += TILE_DIMS) {
+                uint32_t nd = dims - d0 < TILE_DIMS ? dims - d0 : TILE_DIMS;
+                float *x = buffers->point_values[p];
+                if (nr_chunks > 1) {
+                    x = read_coordinates((base + p) * dims + d0, nd, &buffers->dequantized[p * TILE_DIMS],
+                                         &buffers->point_slots[p * SLOT_BYTES]);
+                }
+                __mram_ptr uint8_t *row = (__mram_ptr uint8_t *)&sums[j * dims + d0];
+                float *sum = mram_read_unaligned(row, buffers->scratch, nd * sizeof(float));
+                for (uint32_t d = 0; d < nd; d++) {
+                    sum[d] += x[d];
+                }
+                mram_write_unaligned(buffers->scratch, row, nd * sizeof(float));
+            }
+            __mram_ptr uint8_t *count = (__mram_ptr uint8_t *)&counts[j];
+            (*(uint32_t *)mram_read_unaligned(count, buffers->scratch, sizeof(uint32_t)))++;
+            mram_write_unaligned(buffers->scratch, count, sizeof(uint32_t));
+        }
+    }
+
+    tasklet_inertia[tasklet_id] = inertia;
+    tasklet_searches[tasklet_id] = searches;
+    far_distance[tasklet_id] = far;
+    far_label[tasklet_id] = far_cluster;
+    far_index[tasklet_id] = far_point_index;
+}
+
+// Tiled mode: fold the MRAM accumulators of all tasklets straight into
+// partial_sums and step_result, each tasklet on a strided set of chunks
+void reduce_tiled(uint32_t tasklet_id, tile_buffers_t *buffers, uint32_t sums_bytes, uint32_t counts_bytes) {
+    float *sum = (float *)buffers->point_slots, *other_sum = (float *)buffers->centroid_slots;
+    uint32_t *count = (uint32_t *)buffers->point_slots, *other_count = (uint32_t *)buffers->centroid_slots;
+
+    for (uint32_t off = tasklet_id * REDUCE_BYTES; off < sums_bytes; off += NR_TASKLETS * REDUCE_BYTES) {
+        uint32_t bytes = sums_bytes - off < REDUCE_BYTES ? sums_bytes - off : REDUCE_BYTES;
+        mram_read((__mram_ptr uint8_t *)mram_sums + off, sum, bytes);
+        for (uint32_t t = 1; t < NR_TASKLETS; t++) {
+            mram_read((__mram_ptr uint8_t *)&mram_sums[t * MAX_CENTROID_FLOATS] + off, other_sum, bytes);
+            for (uint32_t i = 0; i < bytes / sizeof(float); i++) {
+                sum[i] += other_sum[i];
+            }
+        }
+        mram_write(sum, (__mram_ptr uint8_t *)partial_sums + off, bytes);
+    }
+    for (uint32_t off = tasklet_id * REDUCE_BYTES; off < counts_bytes; off += NR_TASKLETS * REDUCE_BYTES) {
+        uint32_t bytes = counts_bytes - off < REDUCE_BYTES ? counts_bytes - off : REDUCE_BYTES;
+        mram_read((__mram_ptr uint8_t *)mram_counts + off, count, bytes);
+        for (uint32_t t = 1; t < NR_TASKLETS; t++) {
+            mram_read((__mram_ptr uint8_t *)&mram_counts[t * MAX_K] + off, other_count, bytes);
+            for (uint32_t i = 0; i < bytes / sizeof(uint32_t); i++) {
+                count[i] += other_count[i];
+            }
+        }
+        mram_write(count, (__mram_ptr uint8_t *)step_result.counts + off, bytes);
+    }
+    if (tasklet_id == 0) {
+        dpu_inertia = 0.0;
+        dpu_searches = 0;
+        for (uint32_t t = 0; t < NR_TASKLETS; t++) {
+            dpu_inertia += tasklet_inertia[t];
+            dpu_searches += tasklet_searches[t];
+        }
+    }
+}
+
+// Tiled MODE_BATCH: move the centroids in MRAM to their means, each tasklet on
+// a strided set of chunks so that no two tasklets write the same 8 bytes
+void update_tiled(uint32_t tasklet_id, tile_buffers_t *buffers, uint32_t sums_bytes) {
+    uint32_t dims = DPU_INPUT_ARGUMENTS.dims;
+    uint32_t len = DPU_INPUT_ARGUMENTS.k * dims;
+    float *centroid = (float *)buffers->point_slots, *sum = (float *)buffers->centroid_slots;
+
+    for (uint32_t off = tasklet_id * REDUCE_BYTES; off < sums_bytes; off += NR_TASKLETS * REDUCE_BYTES) {
+        uint32_t bytes = sums_bytes - off < REDUCE_BYTES ? sums_bytes - off : REDUCE_BYTES;
+        uint32_t cached = UINT32_MAX, count = 0;
+        mram_read((__mram_ptr uint8_t *)centroids + off, centroid, bytes);
+        mram_read((__mram_ptr uint8_t *)partial_sums + off, sum, bytes);
+        for (uint32_t i = 0; i < bytes / sizeof(float) && off / sizeof(float) + i < len; i++) {
+            uint32_t j = (off / sizeof(float) + i) / dims;
+            if (j != cached) {
+                count = *(uint32_t *)mram_read_unaligned((__mram_ptr uint8_t *)&step_result.counts[j], buffers->scratch,
+                                                         sizeof(uint32_t));
+                cached = j;
+            }
+            if (count != 0 && sum[i] / count != centroid[i]) {
+                centroid[i] = sum[i] / count;
+                centroids_changed = 1;
+            }
+        }
+        mram_write(centroid, (__mram_ptr uint8_t *)centroids + off, bytes);
+    }
+}
+
+// Tiled mode: zero this tasklet's MRAM accumulators
+void clear_tiled(uint32_t tasklet_id, uint32_t sums_bytes, uint32_t counts_bytes) {
+    __mram_ptr uint8_t *sums = (__mram_ptr uint8_t *)&mram_sums[tasklet_id * MAX_CENTROID_FLOATS];
+    __mram_ptr uint8_t *counts = (__mram_ptr uint8_t *)&mram_counts[tasklet_id * MAX_K];
+
+    for (uint32_t off = 0; off < sums_bytes; off += MAX_DMA_BYTES) {
+        mram_write(zeros, sums + off, sums_bytes - off < MAX_DMA_BYTES ? sums_bytes - off : MAX_DMA_BYTES);
+    }
+    for (uint32_t off = 0; off < counts_bytes; off += MAX_DMA_BYTES) {
+        mram_write(zeros, counts + off, counts_bytes - off < MAX_DMA_BYTES ? counts_bytes - off : MAX_DMA_BYTES);
+    }
+}
+
+void alloc_tile_buffers(tile_buffers_t *buffers, uint32_t width) {
+    buffers->point_slots = mem_alloc(TILE_POINTS * SLOT_BYTES);
+    buffers->centroid_slots = mem_alloc(TILE_CENTROIDS * SLOT_BYTES);
+    buffers->dequantized = NULL;
+    if (DPU_INPUT_ARGUMENTS.format == POINTS_UINT16) {
+        buffers->dequantized = mem_alloc(TILE_POINTS * TILE_DIMS * sizeof(float));
+    }
+    buffers->distances = mem_alloc(TILE_POINTS * TILE_CENTROIDS * sizeof(float));
+    buffers->best = mem_alloc(TILE_POINTS * sizeof(float));
+    buffers->best_label = mem_alloc(TILE_POINTS * sizeof(uint32_t));
+    buffers->second = NULL;
+    buffers->lower = NULL;
+    if (DPU_INPUT_ARGUMENTS.track_bounds) {
+        buffers->second = mem_alloc(TILE_POINTS * sizeof(float));
+        buffers->lower = mem_alloc(TILE_POINTS * sizeof(float));
+    }
+    buffers->labels = mem_alloc(TILE_POINTS * width);
+    buffers->scratch = mem_alloc(SLOT_BYTES);
+}
+
+void clear_partials(uint32_t tasklet_id, uint32_t sums_bytes, uint32_t counts_bytes) {
+    for (uint32_t i = 0; i < sums_bytes / sizeof(float); i++) {
+        tasklet_sums[tasklet_id][i] = 0.0;
+    }
+    for (uint32_t j = 0; j < counts_bytes / sizeof(uint32_t); j++) {
+        tasklet_counts[tasklet_id][j] = 0;
+    }
+}
+
+// Tasklet 0: charge the cycles since *start to phase and start the next one
+static void end_phase(uint64_t *phase_cycles, uint32_t phase, perfcounter_t *start) {
+    perfcounter_t now = perfcounter_get();
+    phase_cycles[phase] += now - *start;
+    *start = now;
+}
+
+int main() {
+    uint32_t tasklet_id = me();
+    uint32_t k = DPU_INPUT_ARGUMENTS.k;
+    uint32_t dims = DPU_INPUT_ARGUMENTS.dims;
+    uint32_t sums_bytes = ALIGN8(k * dims * sizeof(float));
+    uint32_t counts_bytes = ALIGN8(k * sizeof(uint32_t));
+    int batch = DPU_INPUT_ARGUMENTS.mode == MODE_BATCH;
+    int predict = DPU_INPUT_ARGUMENTS.mode == MODE_PREDICT;
+    uint32_t max_iterations = batch ? DPU_INPUT_ARGUMENTS.max_iterations : 1;
+    uint32_t per_block = points_per_block(dims, DPU_INPUT_ARGUMENTS.block_bytes);
+    uint32_t iteration;
+    float *block = NULL;
+    uint8_t *labels = NULL;
+    uint16_t *candidates = NULL;
+    uint16_t *packed = NULL;
+    float *box = NULL;
+    float *nearest = NULL;
+    float *lower = NULL;
+    tile_buffers_t buffers;
+    uint64_t phase_cycles[NR_DPU_PHASES] = {0};  // Tasklet 0
+    perfcounter_t phase_start = 0;
+
+    if (DPU_INPUT_ARGUMENTS.mode == MODE_GENERATE) {
+        if (tasklet_id == 0) {
+            mem_reset();
+        }
+        barrier_wait(&my_barrier);
+        generate_points(tasklet_id);
+        return 0;
+    }
+
+    if (tasklet_id == 0) {
+        perfcounter_config(COUNT_CYCLES, true);
+        mem_reset();
+        tiled = !fits_in_wram();
+        if (DPU_INPUT_ARGUMENTS.format == POINTS_UINT16) {
+            dequantize_offset = mem_alloc(ALIGN8(dims * sizeof(float)));
+            dequantize_scale = mem_alloc(ALIGN8(dims * sizeof(float)));
+            mram_read_large(quantization.offset, dequantize_offset, ALIGN8(dims * sizeof(float)));
+            mram_read_large(quantization.scale, dequantize_scale, ALIGN8(dims * sizeof(float)));
+        }
+        if (tiled) {
+            zeros = mem_alloc(MAX_DMA_BYTES);
+            for (uint32_t i = 0; i < MAX_DMA_BYTES; i++) {
+                zeros[i] = 0;
+            }
+        } else {
+            wram_centroids = mem_alloc(sums_bytes);
+            mram_read_large(centroids, wram_centroids, sums_bytes);
+        }
+    }
+    barrier_wait(&my_barrier);
+    if (tasklet_id == 0) {
+        end_phase(phase_cycles, PHASE_SETUP, &phase_start);
+    }
+
+    if (tiled) {
+        alloc_tile_buffers(&buffers, label_bytes(k));
+    } else {
+        if (predict) {
+            if (DPU_INPUT_ARGUMENTS.want_distances) {
+                nearest = mem_alloc(per_block * sizeof(float));
+            }
+        } else {
+            tasklet_sums[tasklet_id] = mem_alloc(sums_bytes);
+            tasklet_counts[tasklet_id] = mem_alloc(counts_bytes);
+            far_point[tasklet_id] = mem_alloc(ALIGN8(dims * sizeof(float)));
+            if (DPU_INPUT_ARGUMENTS.track_bounds) {
+                lower = mem_alloc(per_block * sizeof(float));
+            }
+        }
+        block = mem_alloc(per_block * dims * sizeof(float));
+        labels = mem_alloc(ALIGN8(per_block * label_bytes(k)));
+        candidates = mem_alloc(ALIGN8(k * sizeof(uint16_t)));
+        if (DPU_INPUT_ARGUMENTS.format == POINTS_UINT16) {
+            packed = mem_alloc(per_block * dims * sizeof(uint16_t));
+        }
+        if (DPU_INPUT_ARGUMENTS.tile_points) {
+            box = mem_alloc(2 * dims * sizeof(float));
+        }
+    }
+
+    if (predict) {
+        if (tiled) {
+            assign_tiled(tasklet_id, &buffers);
+        } else {
+            assign_clusters(tasklet_id, block, packed, labels, box, candidates, nearest, NULL);
+        }
+        return 0;
+    }
+
+    for (iteration = 0; iteration < max_iterations; iteration++) {
+        if (tiled) {
+            clear_tiled(tasklet_id, sums_bytes, counts_bytes);
+        } else {
+            clear_partials(tasklet_id, sums_bytes, counts_bytes);
+        }
+        barrier_wait(&my_barrier);
+
+        if (tiled) {
+            assign_tiled(tasklet_id, &buffers);
+        } else {
+            assign_clusters(tasklet_id, block, packed, labels, box, candidates, NULL, lower);
+        }
+        if (!batch) {
+            store_far_point(tasklet_id, tiled ? &buffers : NULL);
+        }
+        barrier_wait(&my_barrier);
+
+        // Every tasklet is past the previous convergence check
+        if (tasklet_id == 0) {
+            end_phase(phase_cycles, PHASE_ASSIGN, &phase_start);
+            centroids_changed = 0;
+        }
+        if (tiled) {
+            reduce_tiled(tasklet_id, &buffers, sums_bytes, counts_bytes);
+        } else {
+            reduce_partials(tasklet_id);
+        }
+        barrier_wait(&my_barrier);
+
+        if (batch) {
+            if (!tiled) {
+                if (tasklet_id == 0) {
+                    relocate_empty_clusters();
+                }
+                barrier_wait(&my_barrier);
+            }
+            if (tiled) {
+                update_tiled(tasklet_id, &buffers, sums_bytes);
+            } else {
+                update_centroids(tasklet_id);
+            }
+            barrier_wait(&my_barrier);
+            if (!centroids_changed) {
+                iteration++;
+                break;
+            }
+        }
+    }
+
+    if (tasklet_id == 0) {
+        if (batch) {
+            __dma_aligned dpu_batch_header_t header = {dpu_inertia, iteration, 0};
+            mram_write(&header, &batch_result.header, sizeof(header));
+            if (tiled) {
+                for (uint32_t off = 0; off < sums_bytes; off += REDUCE_BYTES) {
+                    uint32_t bytes = sums_bytes - off < REDUCE_BYTES ? sums_bytes - off : REDUCE_BYTES;
+                    mram_read((__mram_ptr uint8_t *)centroids + off, buffers.point_slots, bytes);
+                    mram_write(buffers.point_slots, (__mram_ptr uint8_t *)batch_result.centroids + off, bytes);
+                }
+            } else {
+                mram_write_large(wram_centroids, batch_result.centroids, sums_bytes);
+            }
+        } else {
+            __dma_aligned dpu_step_header_t header = {dpu_inertia, 0, {0}, dpu_searches, 0};
+            if (!tiled) {
+                mram_write_large(tasklet_sums[0], partial_sums, sums_bytes);
+                mram_write_large(tasklet_counts[0], step_result.counts, counts_bytes);
+            }
+            end_phase(phase_cycles, PHASE_REDUCE, &phase_start);
+            header.cycles = phase_start;
+            for (uint32_t phase = 0; phase < NR_DPU_PHASES; phase++) {
+                header.phase_cycles[phase] = phase_cycles[phase];
+            }
+            mram_write(&header, &step_result.header, sizeof(header));
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,342 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <pythread.h>
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include <numpy/arrayobject.h>
+
+#include "session.h"
+
+// Python binding of session.h: clusters NumPy arrays in place, without the
+// points.txt round-trip. The points are borrowed through the buffer protocol
+// and read straight into the DPU shards; labels and centroids are written
+// straight into the returned arrays. The GIL is released while the DPUs (or
+// the host kd-tree) run, so other Python threads keep going. Session errors
+// become exceptions: ValueError for a rejected job, MemoryError, and
+// RuntimeError for a failed DPU call; Session(nr_dpus=0) needs no DPUs and
+// runs the kd-tree backend only.
+//
+//     import numpy as np, dpukmeans
+//     session = dpukmeans.Session("./dpu")
+//     centroids, labels, inertia, iterations = session.fit(points.astype(np.float32), 15)
+
+#ifndef DPU_BINARY
+#define DPU_BINARY "./dpu"
+#endif
+
+#define DEFAULT_MAX_ITERATIONS 15
+#define SESSION_CLOSED 1  // Never an enum kmeans_status
+
+typedef struct {
+    PyObject_HEAD
+    kmeans_session_t session;
+    int open;
+    // A session runs one job at a time; threads queue here without holding the GIL
+    PyThread_type_lock lock;
+} SessionObject;
+
+// Borrow a C-contiguous nr_points x dims float32 buffer without copying it
+static int get_points(PyObject *obj, const char *name, Py_buffer *view) {
+    const char *format;
+
+    if (PyObject_GetBuffer(obj, view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) != 0) {
+        return -1;
+    }
+    format = view->format ? view->format : "B";
+    if (*format == '@' || *format == '=' || *format == '<') {
+        format++;
+    }
+    if (view->ndim != 2 || view->itemsize != sizeof(float) || strcmp(format, "f") != 0 || view->shape[0] == 0 ||
+        view->shape[1] == 0 || view->shape[0] > UINT32_MAX || view->shape[1] > MAX_DIMENSIONS) {
+        PyErr_Format(PyExc_ValueError,
+                     "%s must be a non-empty C-contiguous 2-D float32 array with at most %d columns "
+                     "(see numpy.ascontiguousarray(..., dtype=numpy.float32))",
+                     name, MAX_DIMENSIONS);
+        PyBuffer_Release(view);
+        return -1;
+    }
+    return 0;
+}
+
+// Raise the exception of a failed session call; what describes the call in the ValueError of a rejection
+static void set_session_error(int status, const char *what) {
+    if (status == SESSION_CLOSED) {
+        PyErr_SetString(PyExc_RuntimeError, "session is closed");
+    } else if (status == KMEANS_NO_MEMORY) {
+        PyErr_NoMemory();
+    } else if (status == KMEANS_DPU_ERROR) {
+        PyErr_SetString(PyExc_RuntimeError, "DPU error, see the session output");
+    } else {
+        PyErr_Format(PyExc_ValueError, "%s rejected by the session, see its output", what);
+    }
+}
+
+static int parse_backend(const char *name, uint32_t *backend) {
+    if (strcmp(name, "dpu") == 0) {
+        *backend = BACKEND_DPU;
+    } else if (strcmp(name, "kdtree") == 0 || strcmp(name, "cpu") == 0) {
+        *backend = BACKEND_KDTREE;
+    } else if (strcmp(name, "auto") == 0) {
+        *backend = BACKEND_AUTO;
+    } else {
+        PyErr_Format(PyExc_ValueError, "unknown backend '%s' (expected 'dpu', 'kdtree' or 'auto')", name);
+        return -1;
+    }
+    return 0;
+}
+
+static int Session_init(SessionObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"binary", "nr_dpus", NULL};
+    const char *binary = DPU_BINARY;
+    unsigned int nr_dpus = DPU_ALLOCATE_ALL;
+    int status;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|sI", kwlist, &binary, &nr_dpus)) {
+        return -1;
+    }
+    if (self->open) {
+        PyErr_SetString(PyExc_RuntimeError, "session is already open");
+        return -1;
+    }
+    if (!self->lock && !(self->lock = PyThread_allocate_lock())) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    if (nr_dpus == 0) {
+        kmeans_session_open_host(&self->session);
+        self->open = 1;
+        return 0;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    status = kmeans_session_open(&self->session, nr_dpus, binary);
+    Py_END_ALLOW_THREADS
+    if (status != KMEANS_OK) {
+        if (status == KMEANS_NO_MEMORY) {
+            PyErr_NoMemory();
+        } else {
+            PyErr_SetString(PyExc_RuntimeError, "cannot open the DPU session");
+        }
+        return -1;
+    }
+    self->open = 1;
+    return 0;
+}
+
+static void close_session(SessionObject *self) {
+    if (self->open) {
+        kmeans_session_close(&self->session);
+        self->open = 0;
+    }
+}
+
+static void Session_dealloc(SessionObject *self) {
+    close_session(self);
+    if (self->lock) {
+        PyThread_free_lock(self->lock);
+    }
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *Session_close(SessionObject *self, PyObject *unused) {
+    (void)unused;
+    Py_BEGIN_ALLOW_THREADS
+    PyThread_acquire_lock(self->lock, WAIT_LOCK);
+    close_session(self);
+    PyThread_release_lock(self->lock);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+static PyObject *Session_fit(SessionObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"points", "k", "max_iterations", "seed", "n_init", "backend", "quantize", "spatial_order",
+                             "coarse_k", "compensated", NULL};
+    PyObject *points_obj;
+    unsigned int k, max_iterations = DEFAULT_MAX_ITERATIONS, seed = 1, n_init = 1, coarse_k = 0;
+    const char *backend = "dpu";
+    int quantize = 0, spatial_order = 0, compensated = 0;
+    kmeans_job_t job;
+    Py_buffer view;
+    PyObject *centroids, *labels;
+    npy_intp shape[2];
+    int status;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OI|IIIsppIp", kwlist, &points_obj, &k, &max_iterations, &seed,
+                                     &n_init, &backend, &quantize, &spatial_order, &coarse_k, &compensated)) {
+        return NULL;
+    }
+    memset(&job, 0, sizeof(job));
+    if (parse_backend(backend, &job.backend) != 0 || get_points(points_obj, "points", &view) != 0) {
+        return NULL;
+    }
+
+    shape[0] = k;
+    shape[1] = view.shape[1];
+    centroids = PyArray_SimpleNew(2, shape, NPY_FLOAT32);
+    labels = PyArray_SimpleNew(1, &view.shape[0], NPY_INT);
+    if (!centroids || !labels) {
+        Py_XDECREF(centroids);
+        Py_XDECREF(labels);
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+
+    job.points = view.buf;
+    job.nr_points = (uint32_t)view.shape[0];
+    job.dims = (uint32_t)view.shape[1];
+    job.k = k;
+    job.max_iterations = max_iterations;
+    job.seed = seed;
+    job.n_init = n_init;
+    job.format = quantize ? POINTS_UINT16 : POINTS_FP32;
+    job.spatial_order = spatial_order;
+    job.coarse_k = coarse_k;
+    job.compensated = compensated;
+    job.centroids = PyArray_DATA((PyArrayObject *)centroids);
+    job.labels = PyArray_DATA((PyArrayObject *)labels);
+
+    Py_BEGIN_ALLOW_THREADS
+    PyThread_acquire_lock(self->lock, WAIT_LOCK);
+    status = self->open ? kmeans_session_run(&self->session, &job) : SESSION_CLOSED;
+    PyThread_release_lock(self->lock);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&view);
+
+    if (status != KMEANS_OK) {
+        Py_DECREF(centroids);
+        Py_DECREF(labels);
+        set_session_error(status, "job");
+        return NULL;
+    }
+    return Py_BuildValue("NNdI", centroids, labels, job.inertia, job.iterations);
+}
+
+static PyObject *Session_predict(SessionObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"centroids", "points", "return_distances", NULL};
+    PyObject *centroids_obj, *points_obj;
+    int return_distances = 0;
+    Py_buffer centroids, points;
+    PyObject *labels, *distances = NULL;
+    int status;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|p", kwlist, &centroids_obj, &points_obj, &return_distances)) {
+        return NULL;
+    }
+    if (get_points(centroids_obj, "centroids", &centroids) != 0) {
+        return NULL;
+    }
+    if (get_points(points_obj, "points", &points) != 0) {
+        PyBuffer_Release(&centroids);
+        return NULL;
+    }
+    if (centroids.shape[1] != points.shape[1] || centroids.shape[0] > MAX_K) {
+        PyErr_Format(PyExc_ValueError, "centroids must have the points' %zd columns and at most %d rows",
+                     points.shape[1], MAX_K);
+        PyBuffer_Release(&centroids);
+        PyBuffer_Release(&points);
+        return NULL;
+    }
+
+    labels = PyArray_SimpleNew(1, &points.shape[0], NPY_INT);
+    if (labels && return_distances) {
+        distances = PyArray_SimpleNew(1, &points.shape[0], NPY_FLOAT32);
+    }
+    if (!labels || (return_distances && !distances)) {
+        Py_XDECREF(labels);
+        PyBuffer_Release(&centroids);
+        PyBuffer_Release(&points);
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    PyThread_acquire_lock(self->lock, WAIT_LOCK);
+    if (!self->open) {
+        status = SESSION_CLOSED;
+    } else {
+        status = kmeans_session_load_centroids(&self->session, centroids.buf, (uint32_t)centroids.shape[0],
+                                               (uint32_t)centroids.shape[1]);
+        if (status == KMEANS_OK) {
+            status = kmeans_session_predict(&self->session, points.buf, (uint32_t)points.shape[0],
+                                            PyArray_DATA((PyArrayObject *)labels),
+                                            distances ? PyArray_DATA((PyArrayObject *)distances) : NULL);
+        }
+    }
+    PyThread_release_lock(self->lock);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&centroids);
+    PyBuffer_Release(&points);
+
+    if (status != KMEANS_OK) {
+        Py_DECREF(labels);
+        Py_XDECREF(distances);
+        set_session_error(status, "prediction");
+        return NULL;
+    }
+    return distances ? Py_BuildValue("NN", labels, distances) : labels;
+}
+
+static PyObject *Session_get_nr_dpus(SessionObject *self, void *closure) {
+    (void)closure;
+    return PyLong_FromUnsignedLong(self->open ? self->session.nr_dpus : 0);
+}
+
+static PyMethodDef Session_methods[] = {
+    {"fit", (PyCFunction)(void (*)(void))Session_fit, METH_VARARGS | METH_KEYWORDS,
+     "fit(points, k, max_iterations=15, seed=1, n_init=1, backend='dpu', quantize=False, spatial_order=False, "
+     "coarse_k=0, compensated=False)\n--\n\n"
+     "Cluster a C-contiguous (n, d) float32 array into k clusters; backend is 'dpu', 'kdtree' (host) or 'auto'\n"
+     "(the kd-tree on a session without DPUs).\n"
+     "compensated merges the per-DPU partial sums with Kahan summation.\n"
+     "Returns (centroids, labels, inertia, iterations)."},
+    {"predict", (PyCFunction)(void (*)(void))Session_predict, METH_VARARGS | METH_KEYWORDS,
+     "predict(centroids, points, return_distances=False)\n--\n\n"
+     "Label the points with their closest centroid on the DPUs. Returns labels, or (labels, squared distances)."},
+    {"close", (PyCFunction)Session_close, METH_NOARGS, "Free the DPUs; the session cannot be used afterwards."},
+    {NULL, NULL, 0, NULL},
+};
+
+static PyGetSetDef Session_getset[] = {
+    {"nr_dpus", (getter)Session_get_nr_dpus, NULL, "DPUs allocated to the session, 0 once closed", NULL},
+    {NULL, NULL, NULL, NULL, NULL},
+};
+
+static PyTypeObject SessionType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "dpukmeans.Session",
+    .tp_basicsize = sizeof(SessionObject),
+    .tp_dealloc = (destructor)Session_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Session(binary='" DPU_BINARY "', nr_dpus=DPU_ALLOCATE_ALL)\n--\n\n"
+              "DPUs allocated with the k-means kernel loaded once, reused by every fit() and predict().\n"
+              "With nr_dpus=0 no DPU is needed: fit() runs on the host kd-tree and predict() is unavailable.",
+    .tp_methods = Session_methods,
+    .tp_getset = Session_getset,
+    .tp_init = (initproc)Session_init,
+    .tp_new = PyType_GenericNew,
+};
+
+static struct PyModuleDef dpukmeans_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "dpukmeans",
+    .m_doc = "k-means on UPMEM DPUs, or on the host kd-tree, for NumPy arrays",
+    .m_size = -1,
+};
+
+PyMODINIT_FUNC PyInit_dpukmeans(void) {
+    PyObject *module;
+
+    import_array();
+    if (PyType_Ready(&SessionType) < 0) {
+        return NULL;
+    }
+    module = PyModule_Create(&dpukmeans_module);
+    if (!module) {
+        return NULL;
+    }
+    Py_INCREF(&SessionType);
+    if (PyModule_AddObject(module, "Session", (PyObject *)&SessionType) < 0 ||
+        PyModule_AddIntConstant(module, "DPU_ALLOCATE_ALL", DPU_ALLOCATE_ALL) < 0) {
+        Py_DECREF(&SessionType);
+        Py_DECREF(module);
+        return NULL;
+    }
+    return module;
+}
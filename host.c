@@ -1,60 +1,260 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <dpu.h>
-#include <dpu_log.h>
-
-#define N_POINTS 10000
-#define DIMENSIONS 2
-
-float points[N_POINTS][DIMENSIONS];
-
-void load_points_from_file(const char* filename) {
-    FILE* file = fopen(filename, "r");
-    if (!file) {
-        printf("Error opening file %s\n", filename);
-        exit(EXIT_FAILURE);
-    }
-
-    for (int i = 0; i < N_POINTS; i++) {
-        for (int j = 0; j < DIMENSIONS; j++) {
-            if (fscanf(file, "%f", &points[i][j]) != 1) {
-                printf("Error reading point %d, dimension %d from file\n", i, j);
-                fclose(file);
-                exit(EXIT_FAILURE);
-            }
-        }
-    }
-
-    fclose(file);
-}
-
-int main() {
-    struct dpu_set_t dpus, dpu;
-
-    // Load points from the file
-    load_points_from_file("points.txt");
-
-    // Allocate a simulated DPU
-    DPU_ASSERT(dpu_alloc(DPU_ALLOCATE_ALL, NULL, &dpus));
-
-    // Load the DPU program onto the simulator
-    DPU_ASSERT(dpu_load(dpus, "new_advanced_dpu", NULL));
-
-    // Transfer the points to the simulated DPU's MRAM
-    DPU_FOREACH(dpus, dpu) {
-        DPU_ASSERT(dpu_copy_to(dpu, "points", 0, points, sizeof(points)));
-    }
-
-    // Run the DPU program on the simulator
-    DPU_ASSERT(dpu_launch(dpus, DPU_SYNCHRONOUS));
-
-    // Retrieve and print logs from the simulator
-    DPU_FOREACH(dpus, dpu) {
-        dpu_log_read(dpu, stdout);
-    }
-
-    // Free the simulated DPUs
-    DPU_ASSERT(dpu_free(dpus));
-
-    return 0;
-}
+// clock_gettime under --std=c99
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dpu.h>
+
+#include "autotune.h"
+#include "pointsfile.h"
+#include "session.h"
+
+#ifndef DPU_BINARY
+#define DPU_BINARY "./dpu"
+#endif
+
+#define N_POINTS 10000
+#define DIMENSIONS 2
+#define K 6            // Number of clusters
+#define MAX_ITERATIONS 15
+#define SEED 1
+#define GENERATED_SPREAD 0.05f  // -g: standard deviation around the K generated centers
+
+// -s: two iterations on 1% of the points, two on 10%, then full passes
+static const kmeans_stage_t SCHEDULE[] = {{0.01f, 2}, {0.1f, 2}};
+
+float points[N_POINTS][DIMENSIONS];
+int clusters[N_POINTS];
+
+// Parse points.txt in parallel; reports bad rows and counts instead of exiting halfway
+int load_points_from_file(const char* filename) {
+    points_file_result_t result;
+    int status = points_file_load(filename, &points[0][0], N_POINTS, DIMENSIONS, 0, &result);
+
+    if (status == POINTS_FILE_COLUMNS || status == POINTS_FILE_NUMBER) {
+        printf("Error reading %s, line %llu: %s\n", filename, (unsigned long long)result.line, points_file_error(status));
+        return -1;
+    }
+    if (status != POINTS_FILE_OK && status != POINTS_FILE_ROWS) {
+        printf("Error reading %s: %s\n", filename, points_file_error(status));
+        return -1;
+    }
+    if (result.nr_points != N_POINTS) {
+        printf("Error reading %s: %u points for %d expected\n", filename, result.nr_points, N_POINTS);
+        return -1;
+    }
+    return 0;
+}
+
+// Function to print centroids
+void print_centroids(const char* title, const kmeans_job_t* job) {
+    printf("%s:\n", title);
+    for (uint32_t i = 0; i < job->k; i++) {
+        printf("Centroid %u: (", i);
+        for (uint32_t j = 0; j < job->dims; j++) {
+            printf("%f", job->centroids[i * job->dims + j]);
+            if (j < job->dims - 1) printf(", ");
+        }
+        printf(")\n");
+    }
+}
+
+double elapsed_ms(struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Usage: ./host [-b] [-q] [-z] [-t] [-p] [-i] [-s] [-a] [-c] [-g n_points] [-h coarse_k] [-n n_init] [K...]  runs one job per K on the same session (default: K).
+// With -b the jobs are independent problems clustered on one DPU each, in a single launch.
+// With -n every job keeps the best of n_init restarts run in parallel on groups of DPUs.
+// With -q the points are shipped and stored as uint16 instead of float.
+// With -z the points are sorted along a Z-order curve and the DPUs prune centroids per tile.
+// With -t the jobs run on the host with kd-tree filtering instead of the DPUs.
+// With -h every job first clusters into coarse_k groups, then splits each group on its own DPU.
+// With -p the points are labelled again against the first job's centroids with the predict API.
+// With -s the first iterations run on a stratified subsample of the points (see SCHEDULE).
+// With -i the jobs are incremental and see the first 90% of the points; the rest is then appended to the last job.
+// With -a every job's shape is first autotuned over the dpu-t<tasklets> variants into TUNE_CACHE.
+// The session always loads the variant TUNE_CACHE holds for the first job's shape, if any.
+// With -c the per-DPU partial sums are merged on the host with Kahan summation.
+// With -g the DPUs generate n_points synthetic points around K centers instead of reading points.txt.
+int main(int argc, char** argv) {
+    kmeans_session_t session;
+    int batch = 0;
+    uint32_t n_init = 1;
+    uint32_t format = POINTS_FP32;
+    uint32_t spatial_order = 0;
+    uint32_t backend = BACKEND_DPU;
+    uint32_t coarse_k = 0;
+    int predict = 0;
+    uint32_t incremental = 0;
+    uint32_t nr_stages = 0;
+    uint32_t nr_generated = 0;
+    int autotune = 0;
+    uint32_t compensated = 0;
+    dpu_generator_t generator = {SEED, K, GENERATED_SPREAD, 0};
+    int arg = 1;
+    struct timespec start;
+    int status;
+
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-b") == 0) {
+            batch = 1;
+        } else if (strcmp(argv[arg], "-q") == 0) {
+            format = POINTS_UINT16;
+        } else if (strcmp(argv[arg], "-z") == 0) {
+            spatial_order = 1;
+        } else if (strcmp(argv[arg], "-t") == 0) {
+            backend = BACKEND_KDTREE;
+        } else if (strcmp(argv[arg], "-p") == 0) {
+            predict = 1;
+        } else if (strcmp(argv[arg], "-i") == 0) {
+            incremental = 1;
+        } else if (strcmp(argv[arg], "-s") == 0) {
+            nr_stages = sizeof(SCHEDULE) / sizeof(SCHEDULE[0]);
+        } else if (strcmp(argv[arg], "-a") == 0) {
+            autotune = 1;
+        } else if (strcmp(argv[arg], "-c") == 0) {
+            compensated = 1;
+        } else if (strcmp(argv[arg], "-g") == 0 && arg + 1 < argc) {
+            nr_generated = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "-h") == 0 && arg + 1 < argc) {
+            coarse_k = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "-n") == 0 && arg + 1 < argc) {
+            n_init = atoi(argv[++arg]);
+        } else {
+            printf("Usage: %s [-b] [-q] [-z] [-t] [-p] [-i] [-s] [-a] [-c] [-g n_points] [-h coarse_k] [-n n_init] [K...]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    char** ks = &argv[arg];
+    int nr_jobs = arg < argc ? argc - arg : 1;
+    kmeans_job_t* jobs = calloc(nr_jobs, sizeof(kmeans_job_t));
+
+    // Load points from the file, unless the DPUs generate them
+    if (nr_generated == 0 && load_points_from_file("points.txt") != 0) {
+        free(jobs);
+        return EXIT_FAILURE;
+    }
+
+    uint32_t nr_points = nr_generated > 0 ? nr_generated : N_POINTS;
+    for (int i = 0; autotune && i < nr_jobs; i++) {
+        kmeans_tuning_t best;
+        uint32_t k = arg < argc ? (uint32_t)atoi(ks[i]) : K;
+        printf("Tuning N=%u, D=%d, K=%u:\n", nr_points, DIMENSIONS, k);
+        if (kmeans_tune(DPU_BINARY, TUNE_CACHE, DPU_ALLOCATE_ALL, NULL, nr_points, DIMENSIONS, k, stdout, &best) == 0) {
+            printf("Best: %u tasklets, %u-byte blocks\n", best.nr_tasklets, best.block_bytes);
+        }
+    }
+
+    // Allocate every available DPU and load the k-means kernel, once for all jobs
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (kmeans_session_open_tuned(&session, DPU_ALLOCATE_ALL, DPU_BINARY, TUNE_CACHE, nr_points, DIMENSIONS,
+                                  arg < argc ? (uint32_t)atoi(ks[0]) : K) != 0) {
+        free(jobs);
+        return EXIT_FAILURE;
+    }
+    printf("Session ready in %.1f ms", elapsed_ms(&start));
+    if (session.nr_tasklets) {
+        printf(" (tuned: %u tasklets, %u-byte blocks)", session.nr_tasklets, session.block_bytes);
+    }
+    printf("\n");
+
+    for (int i = 0; i < nr_jobs; i++) {
+        jobs[i].points = &points[0][0];
+        jobs[i].generator = nr_generated > 0 ? &generator : NULL;
+        jobs[i].nr_points = incremental ? N_POINTS - N_POINTS / 10 : nr_points;
+        jobs[i].dims = DIMENSIONS;
+        jobs[i].k = arg < argc ? (uint32_t)atoi(ks[i]) : K;
+        jobs[i].max_iterations = MAX_ITERATIONS;
+        jobs[i].seed = SEED + i;
+        jobs[i].n_init = n_init;
+        jobs[i].format = format;
+        jobs[i].spatial_order = spatial_order;
+        jobs[i].backend = backend;
+        jobs[i].coarse_k = coarse_k;
+        jobs[i].incremental = incremental;
+        jobs[i].compensated = compensated;
+        jobs[i].schedule = SCHEDULE;
+        jobs[i].nr_stages = nr_stages;
+        jobs[i].centroids = malloc((size_t)jobs[i].k * DIMENSIONS * sizeof(float));
+        jobs[i].labels = nr_generated > 0 ? NULL : clusters;
+        jobs[i].history = malloc(MAX_ITERATIONS * sizeof(double));
+        if (!batch) {
+            kmeans_session_submit(&session, &jobs[i]);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (batch) {
+        status = kmeans_session_run_batch(&session, jobs, nr_jobs);
+    } else {
+        status = kmeans_session_drain(&session);
+    }
+    printf("%d jobs done in %.1f ms\n", nr_jobs, elapsed_ms(&start));
+
+    // The last job is still resident: only the new points are sent
+    if (incremental && !batch && status == 0) {
+        kmeans_job_t* last = &jobs[nr_jobs - 1];
+        uint32_t resident = last->nr_points;
+        last->nr_points = N_POINTS;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        status = kmeans_session_append(&session, last, resident);
+        printf("Appended %u points in %.1f ms, %llu of %llu point assignments were full searches\n",
+               N_POINTS - resident, elapsed_ms(&start), (unsigned long long)last->full_searches,
+               (unsigned long long)last->iterations * N_POINTS);
+    }
+
+    // Serve the first model: label the points again without any iteration (points.txt only)
+    if (predict && nr_generated == 0 && status == 0 &&
+        (status = kmeans_session_load_centroids(&session, jobs[0].centroids, jobs[0].k, DIMENSIONS)) == 0) {
+        static int predicted[N_POINTS];
+        uint32_t changed = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        status = kmeans_session_predict(&session, &points[0][0], N_POINTS, predicted, NULL);
+        double ms = elapsed_ms(&start);
+        if (status == 0) {
+            printf("Predicted %d points in %.1f ms (%.0f points/s)", N_POINTS, ms, N_POINTS / ms * 1e3);
+            // clusters holds the labels of the last job
+            if (nr_jobs == 1) {
+                for (int i = 0; i < N_POINTS; i++) {
+                    changed += predicted[i] != clusters[i];
+                }
+                printf(", %u labels differ from the last assignment pass", changed);
+            }
+            printf("\n");
+        }
+    }
+
+    for (int i = 0; i < nr_jobs; i++) {
+        if (jobs[i].iterations > 0) {
+            printf("\nJob %d: K=%u, %u iterations, inertia %f, %.2f MB of points scanned in MRAM", i, jobs[i].k,
+                   jobs[i].iterations, jobs[i].inertia, jobs[i].bytes_scanned / 1e6);
+            if (jobs[i].relocated > 0) {
+                printf(", %u empty clusters relocated", jobs[i].relocated);
+            }
+            if (!batch) {
+                printf(" (seed %u of %u restarts)\n", jobs[i].best_seed, n_init);
+                if (format == POINTS_UINT16) {
+                    printf("uint16 points: centroids within %g of the fp32 means\n", jobs[i].centroid_error);
+                }
+                for (uint32_t it = 0; it < jobs[i].iterations; it++) {
+                    printf("Iteration %u: inertia %f\n", it + 1, jobs[i].history[it]);
+                }
+            } else {
+                printf("\n");
+            }
+            print_centroids("Final Centroids", &jobs[i]);
+        }
+        free(jobs[i].centroids);
+        free(jobs[i].history);
+    }
+
+    kmeans_session_close(&session);
+    free(jobs);
+
+    return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
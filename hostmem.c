@@ -0,0 +1,257 @@
+// sched_setaffinity and MAP_HUGETLB
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "hostmem.h"
+
+#define MPOL_PREFERRED 1  // From linux/mempolicy.h, without depending on libnuma
+
+int hostmem_rank_node(uint32_t rank_id) {
+    static const char *const PATHS[] = {"/sys/class/dpu_rank/dpu_rank%u/numa_node",
+                                        "/sys/class/dpu_rank/dpu_rank%u/device/numa_node"};
+    char path[128];
+    int node = -1;
+
+    for (uint32_t p = 0; p < sizeof(PATHS) / sizeof(PATHS[0]) && node < 0; p++) {
+        FILE *file;
+        snprintf(path, sizeof(path), PATHS[p], rank_id);
+        if ((file = fopen(path, "r"))) {
+            if (fscanf(file, "%d", &node) != 1) {
+                node = -1;
+            }
+            fclose(file);
+        }
+    }
+    return node;
+}
+
+// Pin the calling thread to the CPUs of node, from its sysfs cpulist ("0-15,32-47")
+static int pin_to_node(int node) {
+    char path[128], list[4096];
+    cpu_set_t cpus;
+    FILE *file;
+    char *cursor;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    if (!(file = fopen(path, "r"))) {
+        return -1;
+    }
+    cursor = fgets(list, sizeof(list), file);
+    fclose(file);
+    if (!cursor) {
+        return -1;
+    }
+    CPU_ZERO(&cpus);
+    while (*cursor >= '0' && *cursor <= '9') {
+        long first = strtol(cursor, &cursor, 10), last = first;
+        if (*cursor == '-') {
+            last = strtol(cursor + 1, &cursor, 10);
+        }
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, &cpus);
+        }
+        if (*cursor == ',') {
+            cursor++;
+        }
+    }
+    return CPU_COUNT(&cpus) > 0 ? sched_setaffinity(0, sizeof(cpus), &cpus) : -1;
+}
+
+void *hostmem_alloc(size_t bytes, int node, size_t *mapped) {
+    size_t size = (bytes + HOSTMEM_HUGEPAGE_BYTES - 1) / HOSTMEM_HUGEPAGE_BYTES * HOSTMEM_HUGEPAGE_BYTES;
+    void *buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+    if (buffer == MAP_FAILED) {
+        buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buffer == MAP_FAILED) {
+            return NULL;
+        }
+        madvise(buffer, size, MADV_HUGEPAGE);
+    }
+    // Pages are only faulted in by the first write; prefer the rank's node for them
+    if (node >= 0 && node < HOSTMEM_MAX_NODES) {
+        unsigned long mask = 1ul << node;
+        syscall(SYS_mbind, buffer, size, MPOL_PREFERRED, &mask, 8 * sizeof(mask) + 1, 0);
+    }
+    *mapped = size;
+    return buffer;
+}
+
+void hostmem_free(void *buffer, size_t mapped) {
+    if (buffer) {
+        munmap(buffer, mapped);
+    }
+}
+
+struct hostmem_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t work;  // Signaled when tasks are posted or the pool stops
+    pthread_cond_t done;  // Signaled when the last task of a run finished
+    pthread_t *threads;
+    int *worker_nodes;
+    uint32_t nr_workers;
+    int stop;
+    // Current run, under lock
+    void (*fn)(void *arg, uint32_t task);
+    void *arg;
+    uint32_t nr_tasks, nr_done;
+    int *task_nodes;      // -1: any thread may run the task
+    uint8_t *claimed;
+    uint32_t capacity;    // Of task_nodes and claimed
+};
+
+typedef struct {
+    hostmem_pool_t *pool;
+    uint32_t worker;
+} pool_worker_t;
+
+// Under lock: the first unclaimed task that a thread on node may run (-2 for
+// the calling thread, which is not pinned), claimed; nr_tasks if none
+static uint32_t claim_task(hostmem_pool_t *pool, int node) {
+    for (uint32_t t = 0; t < pool->nr_tasks; t++) {
+        if (!pool->claimed[t] && (pool->task_nodes[t] < 0 || pool->task_nodes[t] == node)) {
+            pool->claimed[t] = 1;
+            return t;
+        }
+    }
+    return pool->nr_tasks;
+}
+
+// Under lock: run task t unlocked and count it
+static void run_task(hostmem_pool_t *pool, uint32_t t) {
+    void (*fn)(void *arg, uint32_t task) = pool->fn;
+    void *arg = pool->arg;
+
+    pthread_mutex_unlock(&pool->lock);
+    fn(arg, t);
+    pthread_mutex_lock(&pool->lock);
+    if (++pool->nr_done == pool->nr_tasks) {
+        pthread_cond_signal(&pool->done);
+    }
+}
+
+static void *pool_worker(void *arg) {
+    pool_worker_t *self = arg;
+    hostmem_pool_t *pool = self->pool;
+    int node = pool->worker_nodes[self->worker];
+
+    free(self);
+    if (node >= 0) {
+        pin_to_node(node);
+    }
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->stop) {
+        uint32_t t = claim_task(pool, node);
+        if (t < pool->nr_tasks) {
+            run_task(pool, t);
+        } else {
+            pthread_cond_wait(&pool->work, &pool->lock);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+hostmem_pool_t *hostmem_pool_create(uint32_t nr_workers, const int *nodes) {
+    hostmem_pool_t *pool = calloc(1, sizeof(hostmem_pool_t));
+
+    if (!pool) {
+        return NULL;
+    }
+    pool->threads = malloc(nr_workers * sizeof(pthread_t));
+    pool->worker_nodes = malloc(nr_workers * sizeof(int));
+    if (!pool->threads || !pool->worker_nodes || pthread_mutex_init(&pool->lock, NULL) != 0) {
+        free(pool->threads);
+        free(pool->worker_nodes);
+        free(pool);
+        return NULL;
+    }
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (uint32_t w = 0; w < nr_workers; w++) {
+        pool_worker_t *worker = malloc(sizeof(pool_worker_t));
+        if (!worker) {
+            break;
+        }
+        *worker = (pool_worker_t){pool, w};
+        pool->worker_nodes[w] = nodes ? nodes[w] : -1;
+        if (pthread_create(&pool->threads[pool->nr_workers], NULL, pool_worker, worker) != 0) {
+            free(worker);
+            break;
+        }
+        pool->nr_workers++;
+    }
+    return pool;
+}
+
+void hostmem_pool_run(hostmem_pool_t *pool, uint32_t nr_tasks, const int *nodes,
+                      void (*fn)(void *arg, uint32_t task), void *arg) {
+    if (pool && nr_tasks > pool->capacity) {
+        int *task_nodes = realloc(pool->task_nodes, nr_tasks * sizeof(int));
+        uint8_t *claimed = task_nodes ? realloc(pool->claimed, nr_tasks) : NULL;
+        pool->task_nodes = task_nodes ? task_nodes : pool->task_nodes;
+        pool->claimed = claimed ? claimed : pool->claimed;
+        pool->capacity = task_nodes && claimed ? nr_tasks : pool->capacity;
+    }
+    if (!pool || pool->nr_workers == 0 || nr_tasks > pool->capacity) {
+        for (uint32_t t = 0; t < nr_tasks; t++) {
+            fn(arg, t);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    for (uint32_t t = 0; t < nr_tasks; t++) {
+        // A node no worker is pinned to is left to any thread
+        int node = nodes ? nodes[t] : -1;
+        uint32_t w = 0;
+        while (node >= 0 && w < pool->nr_workers && pool->worker_nodes[w] != node) {
+            w++;
+        }
+        pool->task_nodes[t] = w < pool->nr_workers ? node : -1;
+        pool->claimed[t] = 0;
+    }
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->nr_tasks = nr_tasks;
+    pool->nr_done = 0;
+    pthread_cond_broadcast(&pool->work);
+    // The calling thread takes its share of the unpinned tasks
+    for (uint32_t t; (t = claim_task(pool, -2)) < nr_tasks;) {
+        run_task(pool, t);
+    }
+    while (pool->nr_done < nr_tasks) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pool->nr_tasks = 0;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void hostmem_pool_free(hostmem_pool_t *pool) {
+    if (!pool) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (uint32_t w = 0; w < pool->nr_workers; w++) {
+        pthread_join(pool->threads[w], NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->done);
+    free(pool->threads);
+    free(pool->worker_nodes);
+    free(pool->task_nodes);
+    free(pool->claimed);
+    free(pool);
+}
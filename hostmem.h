@@ -0,0 +1,41 @@
+#ifndef _HOSTMEM_H_
+#define _HOSTMEM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// NUMA placement of the host side of the transfers. On a multi-socket host
+// every DPU rank hangs off one socket; staging its shards in that socket's
+// memory, written by threads running on that socket, keeps the copies and the
+// rank transfer from crossing the interconnect. Everything degrades to plain
+// memory and unpinned threads when the topology is unknown (simulator, no sysfs).
+
+#define HOSTMEM_HUGEPAGE_BYTES (2 << 20)
+#define HOSTMEM_MAX_NODES 64  // Nodes above are left to the kernel's default policy
+
+// NUMA node the rank the driver numbers rank_id (/dev/dpu_rank<rank_id>) is
+// attached to, from its sysfs entry; -1 if unknown
+int hostmem_rank_node(uint32_t rank_id);
+
+// Anonymous memory, from the hugepage pool if it has room, else transparent
+// hugepages; placed on node if >= 0. *mapped receives the size to pass to
+// hostmem_free(). Returns NULL if out of memory.
+void *hostmem_alloc(size_t bytes, int node, size_t *mapped);
+void hostmem_free(void *buffer, size_t mapped);
+
+// Worker threads kept for the life of a session, so that the staging and
+// reduction passes of every iteration do not create threads. Worker w is
+// pinned to the CPUs of nodes[w] (unpinned for -1 or with nodes NULL).
+// Returns NULL if out of memory; a pool may also have fewer workers than asked.
+typedef struct hostmem_pool hostmem_pool_t;
+hostmem_pool_t *hostmem_pool_create(uint32_t nr_workers, const int *nodes);
+void hostmem_pool_free(hostmem_pool_t *pool);
+
+// Run fn(arg, task) for every task on the workers and the calling thread, and
+// wait for all of them. Task t runs on a worker pinned to nodes[t] when the
+// pool has one; the other tasks (all of them with nodes NULL) run on any
+// thread. Runs inline on the calling thread when pool is NULL or has no workers.
+void hostmem_pool_run(hostmem_pool_t *pool, uint32_t nr_tasks, const int *nodes,
+                      void (*fn)(void *arg, uint32_t task), void *arg);
+
+#endif
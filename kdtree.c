@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kdtree.h"
+
+// Per-iteration state of the filtering pass
+typedef struct {
+    const kd_tree_t *tree;
+    const float *centroids;
+    uint32_t k;
+    double *sums;       // k x dims
+    uint64_t *counts;
+    double inertia;
+    int *labels;        // May be NULL
+    uint32_t *stack;    // Candidate lists, k per tree level
+} kd_pass_t;
+
+static float coordinate(const kd_tree_t *tree, uint32_t point, uint32_t d) {
+    return tree->points[(size_t)point * tree->dims + d];
+}
+
+// Partially sort index[0..n) on dimension dim so that index[nth] is in place
+static void select_nth(const kd_tree_t *tree, uint32_t *index, uint32_t n, uint32_t nth, uint32_t dim) {
+    int64_t lo = 0, hi = (int64_t)n - 1;
+
+    while (lo < hi) {
+        float pivot = coordinate(tree, index[(lo + hi) / 2], dim);
+        int64_t i = lo, j = hi;
+        while (i <= j) {
+            while (coordinate(tree, index[i], dim) < pivot) {
+                i++;
+            }
+            while (coordinate(tree, index[j], dim) > pivot) {
+                j--;
+            }
+            if (i <= j) {
+                uint32_t swap = index[i];
+                index[i++] = index[j];
+                index[j--] = swap;
+            }
+        }
+        if ((int64_t)nth <= j) {
+            hi = j;
+        } else if ((int64_t)nth >= i) {
+            lo = i;
+        } else {
+            break;
+        }
+    }
+}
+
+// Build the subtree of index[start..end), splitting at the median of the widest dimension
+static int32_t build_node(kd_tree_t *tree, uint32_t start, uint32_t end, uint32_t depth) {
+    uint32_t dims = tree->dims;
+    int32_t id = tree->nr_nodes++;
+    kd_node_t *node = &tree->nodes[id];
+    float *low = &tree->bounds[(size_t)id * 2 * dims], *high = low + dims;
+    double *sum = &tree->sums[(size_t)id * dims];
+    uint32_t split = 0;
+
+    if (depth + 1 > tree->height) {
+        tree->height = depth + 1;
+    }
+    node->start = start;
+    node->end = end;
+    node->count = end - start;
+    node->left = node->right = -1;
+    for (uint32_t d = 0; d < dims; d++) {
+        low[d] = high[d] = coordinate(tree, tree->index[start], d);
+        sum[d] = 0.0;
+    }
+    for (uint32_t i = start; i < end; i++) {
+        for (uint32_t d = 0; d < dims; d++) {
+            float x = coordinate(tree, tree->index[i], d);
+            low[d] = x < low[d] ? x : low[d];
+            high[d] = x > high[d] ? x : high[d];
+            sum[d] += x;
+        }
+    }
+    // Scatter around the mean, in a second pass to avoid cancellation
+    node->scatter = 0.0;
+    for (uint32_t i = start; i < end; i++) {
+        for (uint32_t d = 0; d < dims; d++) {
+            double diff = coordinate(tree, tree->index[i], d) - sum[d] / node->count;
+            node->scatter += diff * diff;
+        }
+    }
+
+    for (uint32_t d = 1; d < dims; d++) {
+        if (high[d] - low[d] > high[split] - low[split]) {
+            split = d;
+        }
+    }
+    if (node->count <= KD_LEAF_SIZE || high[split] == low[split]) {
+        return id;
+    }
+    uint32_t middle = start + node->count / 2;
+    select_nth(tree, &tree->index[start], node->count, middle - start, split);
+    int32_t left = build_node(tree, start, middle, depth + 1);
+    int32_t right = build_node(tree, middle, end, depth + 1);
+    tree->nodes[id].left = left;
+    tree->nodes[id].right = right;
+
+    return id;
+}
+
+int kd_tree_build(kd_tree_t *tree, const float *points, uint32_t nr_points, uint32_t dims) {
+    // Median splits leave at least KD_LEAF_SIZE / 2 points per leaf
+    size_t max_nodes = 2 * ((size_t)nr_points / (KD_LEAF_SIZE / 2) + 1);
+
+    memset(tree, 0, sizeof(*tree));
+    tree->points = points;
+    tree->nr_points = nr_points;
+    tree->dims = dims;
+    tree->index = malloc(nr_points * sizeof(uint32_t));
+    tree->nodes = malloc(max_nodes * sizeof(kd_node_t));
+    tree->bounds = malloc(max_nodes * 2 * dims * sizeof(float));
+    tree->sums = malloc(max_nodes * dims * sizeof(double));
+    if (!tree->index || !tree->nodes || !tree->bounds || !tree->sums) {
+        printf("Error: cannot allocate a kd-tree over %u points\n", nr_points);
+        kd_tree_free(tree);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < nr_points; i++) {
+        tree->index[i] = i;
+    }
+    build_node(tree, 0, nr_points, 0);
+    return 0;
+}
+
+void kd_tree_free(kd_tree_t *tree) {
+    free(tree->index);
+    free(tree->nodes);
+    free(tree->bounds);
+    free(tree->sums);
+    memset(tree, 0, sizeof(*tree));
+}
+
+// True if centroid z is farther than centroid best from every point of the box:
+// it is enough to check the box corner furthest in the direction from best to z
+static int dominated(const float *z, const float *best, const float *low, const float *high, uint32_t dims) {
+    double to_z = 0.0, to_best = 0.0;
+
+    for (uint32_t d = 0; d < dims; d++) {
+        double corner = z[d] > best[d] ? high[d] : low[d];
+        to_z += (z[d] - corner) * (z[d] - corner);
+        to_best += (best[d] - corner) * (best[d] - corner);
+    }
+    // Strict, so that ties are left to the per-point comparison
+    return to_z > to_best;
+}
+
+// Give the whole node to centroid j from its cached summaries
+static void assign_node(kd_pass_t *pass, int32_t id, uint32_t j) {
+    const kd_tree_t *tree = pass->tree;
+    const kd_node_t *node = &tree->nodes[id];
+    uint32_t dims = tree->dims;
+    const double *sum = &tree->sums[(size_t)id * dims];
+    const float *c = &pass->centroids[j * dims];
+    double offset = 0.0;
+
+    // sum |x - c|^2 = scatter + count * |mean - c|^2
+    for (uint32_t d = 0; d < dims; d++) {
+        double diff = sum[d] / node->count - c[d];
+        offset += diff * diff;
+        pass->sums[j * dims + d] += sum[d];
+    }
+    pass->inertia += node->scatter + node->count * offset;
+    pass->counts[j] += node->count;
+    if (pass->labels) {
+        for (uint32_t i = node->start; i < node->end; i++) {
+            pass->labels[tree->index[i]] = j;
+        }
+    }
+}
+
+// Assign every point of a leaf among the remaining candidates, in float and in
+// index order like the DPU kernel, so both backends break ties the same way
+static void assign_leaf(kd_pass_t *pass, int32_t id, const uint32_t *candidates, uint32_t nr_candidates) {
+    const kd_tree_t *tree = pass->tree;
+    const kd_node_t *node = &tree->nodes[id];
+    uint32_t dims = tree->dims;
+
+    for (uint32_t i = node->start; i < node->end; i++) {
+        const float *p = &tree->points[(size_t)tree->index[i] * dims];
+        float min_distance = 1e30;
+        uint32_t closest_centroid = candidates[0];
+        for (uint32_t c_index = 0; c_index < nr_candidates; c_index++) {
+            uint32_t j = candidates[c_index];
+            const float *c = &pass->centroids[j * dims];
+            float distance = 0.0;
+            for (uint32_t d = 0; d < dims; d++) {
+                float diff = p[d] - c[d];
+                distance += diff * diff;
+            }
+            if (distance < min_distance) {
+                min_distance = distance;
+                closest_centroid = j;
+            }
+        }
+        pass->inertia += min_distance;
+        for (uint32_t d = 0; d < dims; d++) {
+            pass->sums[closest_centroid * dims + d] += p[d];
+        }
+        pass->counts[closest_centroid]++;
+        if (pass->labels) {
+            pass->labels[tree->index[i]] = closest_centroid;
+        }
+    }
+}
+
+static void filter(kd_pass_t *pass, int32_t id, const uint32_t *candidates, uint32_t nr_candidates, uint32_t depth) {
+    const kd_tree_t *tree = pass->tree;
+    const kd_node_t *node = &tree->nodes[id];
+    uint32_t dims = tree->dims;
+    const float *low = &tree->bounds[(size_t)id * 2 * dims], *high = low + dims;
+    uint32_t *kept = &pass->stack[(size_t)(depth + 1) * pass->k];
+    uint32_t nr_kept = 0;
+    uint32_t best = candidates[0];
+    double best_distance = 1e300;
+
+    // Candidate closest to the middle of the box
+    for (uint32_t c_index = 0; c_index < nr_candidates; c_index++) {
+        const float *c = &pass->centroids[candidates[c_index] * dims];
+        double distance = 0.0;
+        for (uint32_t d = 0; d < dims; d++) {
+            double diff = c[d] - 0.5 * ((double)low[d] + high[d]);
+            distance += diff * diff;
+        }
+        if (distance < best_distance) {
+            best_distance = distance;
+            best = candidates[c_index];
+        }
+    }
+    // Drop the candidates best dominates over the whole box, keeping index order
+    for (uint32_t c_index = 0; c_index < nr_candidates; c_index++) {
+        uint32_t j = candidates[c_index];
+        if (j == best || !dominated(&pass->centroids[j * dims], &pass->centroids[best * dims], low, high, dims)) {
+            kept[nr_kept++] = j;
+        }
+    }
+
+    if (nr_kept == 1) {
+        assign_node(pass, id, best);
+    } else if (node->left < 0) {
+        assign_leaf(pass, id, kept, nr_kept);
+    } else {
+        filter(pass, node->left, kept, nr_kept, depth + 1);
+        filter(pass, node->right, kept, nr_kept, depth + 1);
+    }
+}
+
+double kd_tree_iterate(const kd_tree_t *tree, float *centroids, uint32_t k, int *labels) {
+    uint32_t dims = tree->dims;
+    kd_pass_t pass;
+
+    pass.tree = tree;
+    pass.centroids = centroids;
+    pass.k = k;
+    pass.sums = calloc((size_t)k * dims, sizeof(double));
+    pass.counts = calloc(k, sizeof(uint64_t));
+    pass.inertia = 0.0;
+    pass.labels = labels;
+    pass.stack = calloc((size_t)(tree->height + 1) * k, sizeof(uint32_t));
+    if (!pass.sums || !pass.counts || !pass.stack) {
+        printf("Error: cannot allocate a kd-tree pass over %u centroids\n", k);
+        free(pass.sums);
+        free(pass.counts);
+        free(pass.stack);
+        return -1.0;
+    }
+    for (uint32_t j = 0; j < k; j++) {
+        pass.stack[j] = j;
+    }
+
+    filter(&pass, 0, pass.stack, k, 0);
+
+    for (uint32_t j = 0; j < k; j++) {
+        if (pass.counts[j] != 0) {
+            for (uint32_t d = 0; d < dims; d++) {
+                centroids[j * dims + d] = pass.sums[j * dims + d] / pass.counts[j];
+            }
+        }
+    }
+
+    free(pass.sums);
+    free(pass.counts);
+    free(pass.stack);
+    return pass.inertia;
+}
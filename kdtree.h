@@ -0,0 +1,43 @@
+#ifndef _KDTREE_H_
+#define _KDTREE_H_
+
+#include <stdint.h>
+
+// Host k-means with kd-tree filtering (Kanungo et al.): the tree is built once
+// per job, and every iteration pushes the candidate centroids down the tree,
+// dropping those that cannot own any point of a node's box. A node left with a
+// single candidate is assigned whole from its cached count, sum and scatter,
+// without touching its points. Pays off in low dimensions, where boxes stay tight.
+
+#define KD_LEAF_SIZE 16          // Nodes with at most this many points are not split
+#define KDTREE_AUTO_DIMENSIONS 4  // BACKEND_AUTO sends jobs up to this D to the kd-tree
+
+typedef struct {
+    uint32_t start, end;  // Points index[start..end) of the tree
+    int32_t left, right;  // Children, -1 for a leaf
+    uint32_t count;
+    double scatter;       // Sum of squared distances of the points to their mean
+} kd_node_t;
+
+typedef struct {
+    const float *points;  // nr_points x dims, not copied
+    uint32_t nr_points;
+    uint32_t dims;
+    uint32_t *index;      // Points in tree order
+    kd_node_t *nodes;
+    float *bounds;        // Box of node i: min[dims] then max[dims] at bounds[i * 2 * dims]
+    double *sums;         // Vector sum of node i at sums[i * dims]
+    uint32_t nr_nodes;
+    uint32_t height;
+} kd_tree_t;
+
+// Returns 0 on success, -1 if the tree cannot be allocated
+int kd_tree_build(kd_tree_t *tree, const float *points, uint32_t nr_points, uint32_t dims);
+void kd_tree_free(kd_tree_t *tree);
+
+// One Lloyd iteration: assign every point to its closest centroid, write the
+// labels if not NULL, move every non-empty centroid to its mean and return the
+// inertia of the assignment; -1 if the pass cannot be allocated
+double kd_tree_iterate(const kd_tree_t *tree, float *centroids, uint32_t k, int *labels);
+
+#endif
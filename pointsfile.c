@@ -0,0 +1,345 @@
+// mmap, posix_madvise, sysconf and newlocale under --std=c99
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <float.h>
+#include <locale.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pointsfile.h"
+
+// One thread's share of the file: whole lines [begin, end)
+typedef struct {
+    const char *begin, *end;
+    float *points;
+    uint32_t dims;
+    uint64_t rows;        // Non-blank lines, counted by the first pass
+    uint64_t lines;
+    uint64_t first_row;   // Prefix sums of the counts, set between the passes
+    uint64_t first_line;
+    int status;           // Second pass: first error of the chunk, at line error_line
+    uint64_t error_line;
+} chunk_t;
+
+// LC_NUMERIC of the C locale for the strtof() fallback, created once; (locale_t)0
+// if that failed, and strtof() then runs in the thread's locale
+static pthread_once_t c_locale_once = PTHREAD_ONCE_INIT;
+static locale_t c_locale;
+
+static void create_c_locale(void) {
+    c_locale = newlocale(LC_NUMERIC_MASK, "C", (locale_t)0);
+}
+
+// Exact powers of ten representable in a double
+static const double POW10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                               1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+#define MAX_EXACT_POW10 22
+
+static int is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static int is_separator(char c) {
+    return c == ' ' || c == '\t' || c == ',' || c == '\r';
+}
+
+// Decimal or scientific notation with an optional sign. The first 19
+// significant digits go into an integer mantissa, scaled once by an exact
+// power of ten: within one unit in the last place of the float strtof() returns.
+static int parse_decimal(const char **cursor, const char *end, float *out) {
+    const char *p = *cursor;
+    int negative = 0;
+    uint64_t mantissa = 0;
+    int64_t exponent = 0;
+    uint32_t digits = 0;
+    double value;
+
+    if (p < end && (*p == '+' || *p == '-')) {
+        negative = *p++ == '-';
+    }
+    for (; p < end && is_digit(*p); p++, digits++) {
+        if (mantissa < 1000000000000000000ull) {
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+        } else {
+            exponent++;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && is_digit(*p); p++, digits++) {
+            if (mantissa < 1000000000000000000ull) {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                exponent--;
+            }
+        }
+    }
+    if (digits == 0) {
+        return -1;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        int exponent_negative = 0;
+        int64_t written = 0;
+        const char *start;
+
+        p++;
+        if (p < end && (*p == '+' || *p == '-')) {
+            exponent_negative = *p++ == '-';
+        }
+        for (start = p; p < end && is_digit(*p); p++) {
+            if (written < 100000) {
+                written = written * 10 + (*p - '0');
+            }
+        }
+        if (p == start) {
+            return -1;
+        }
+        exponent += exponent_negative ? -written : written;
+    }
+
+    value = (double)mantissa;
+    if (mantissa == 0 || exponent < -400) {
+        value = 0.0;
+    } else if (exponent > 400) {
+        return -1;
+    } else {
+        for (; exponent > MAX_EXACT_POW10; exponent -= MAX_EXACT_POW10) {
+            value *= POW10[MAX_EXACT_POW10];
+        }
+        for (; exponent < -MAX_EXACT_POW10; exponent += MAX_EXACT_POW10) {
+            value /= POW10[MAX_EXACT_POW10];
+        }
+        value = exponent >= 0 ? value * POW10[exponent] : value / POW10[-exponent];
+    }
+    if (value > FLT_MAX) {
+        return -1;
+    }
+    *out = (float)(negative ? -value : value);
+    *cursor = p;
+    return 0;
+}
+
+// parse_decimal, falling back to strtof() for the other forms fscanf("%f")
+// accepted, such as hexadecimal floats, in the C locale whatever the process
+// one. nan, inf and values out of float range are still rejected: a single
+// one would turn every centroid into nan.
+static int parse_float(const char **cursor, const char *end, float *out) {
+    const char *p = *cursor;
+    const char *token_end = p;
+    char token[64];
+    char *parsed;
+    size_t length;
+    locale_t previous = (locale_t)0;
+
+    while (token_end < end && !is_separator(*token_end)) {
+        token_end++;
+    }
+    if (parse_decimal(&p, token_end, out) == 0 && p == token_end) {
+        *cursor = p;
+        return 0;
+    }
+    length = (size_t)(token_end - *cursor);
+    if (length >= sizeof(token)) {
+        return -1;
+    }
+    memcpy(token, *cursor, length);
+    token[length] = '\0';
+    if (c_locale) {
+        previous = uselocale(c_locale);
+    }
+    *out = strtof(token, &parsed);
+    if (previous) {
+        uselocale(previous);
+    }
+    if (length == 0 || parsed != token + length || !isfinite(*out)) {
+        return -1;
+    }
+    *cursor = token_end;
+    return 0;
+}
+
+static int is_blank(const char *p, const char *eol) {
+    for (; p < eol; p++) {
+        if (!is_separator(*p)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int parse_row(const char *p, const char *eol, uint32_t dims, float *row) {
+    for (uint32_t d = 0; d < dims; d++) {
+        while (p < eol && is_separator(*p)) {
+            p++;
+        }
+        if (p == eol) {
+            return POINTS_FILE_COLUMNS;
+        }
+        if (parse_float(&p, eol, &row[d]) != 0 || (p < eol && !is_separator(*p))) {
+            return POINTS_FILE_NUMBER;
+        }
+    }
+    return is_blank(p, eol) ? POINTS_FILE_OK : POINTS_FILE_COLUMNS;
+}
+
+static const char *end_of_line(const char *p, const char *end) {
+    const char *eol = memchr(p, '\n', end - p);
+    return eol ? eol : end;
+}
+
+// First pass: count the rows of the chunk, so every chunk knows where its rows go
+static void *count_rows(void *arg) {
+    chunk_t *chunk = arg;
+
+    for (const char *p = chunk->begin; p < chunk->end;) {
+        const char *eol = end_of_line(p, chunk->end);
+        chunk->rows += !is_blank(p, eol);
+        chunk->lines++;
+        p = eol + 1;
+    }
+    return NULL;
+}
+
+static void *parse_rows(void *arg) {
+    chunk_t *chunk = arg;
+    float *row = chunk->points + chunk->first_row * chunk->dims;
+    uint64_t line = chunk->first_line;
+
+    for (const char *p = chunk->begin; p < chunk->end; line++) {
+        const char *eol = end_of_line(p, chunk->end);
+        if (!is_blank(p, eol)) {
+            int status = parse_row(p, eol, chunk->dims, row);
+            if (status != POINTS_FILE_OK) {
+                chunk->status = status;
+                chunk->error_line = line + 1;
+                return NULL;
+            }
+            row += chunk->dims;
+        }
+        p = eol + 1;
+    }
+    return NULL;
+}
+
+// Run fn on every chunk, the first one on the calling thread
+static void run_chunks(chunk_t *chunks, uint32_t nr_chunks, void *(*fn)(void *)) {
+    pthread_t threads[POINTS_FILE_MAX_THREADS];
+    uint32_t started = 1;
+
+    for (; started < nr_chunks; started++) {
+        if (pthread_create(&threads[started], NULL, fn, &chunks[started]) != 0) {
+            break;
+        }
+    }
+    fn(&chunks[0]);
+    for (uint32_t c = 1; c < started; c++) {
+        pthread_join(threads[c], NULL);
+    }
+    // Chunks no thread could be started for
+    for (uint32_t c = started; c < nr_chunks; c++) {
+        fn(&chunks[c]);
+    }
+}
+
+int points_file_load(const char *path, float *points, uint32_t max_points, uint32_t dims, uint32_t nr_threads,
+                     points_file_result_t *result) {
+    chunk_t chunks[POINTS_FILE_MAX_THREADS];
+    struct stat info;
+    const char *data, *end;
+    uint64_t rows = 0, lines = 0;
+    uint32_t nr_chunks;
+    int fd, status = POINTS_FILE_OK;
+
+    memset(result, 0, sizeof(*result));
+    pthread_once(&c_locale_once, create_c_locale);
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return POINTS_FILE_OPEN;
+    }
+    if (info.st_size == 0) {
+        close(fd);
+        return POINTS_FILE_OK;
+    }
+    data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return POINTS_FILE_OPEN;
+    }
+    end = data + info.st_size;
+    posix_madvise((void *)data, info.st_size, POSIX_MADV_SEQUENTIAL);
+
+    if (nr_threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nr_threads = cpus > 0 ? (uint32_t)cpus : 1;
+    }
+    nr_chunks = nr_threads < POINTS_FILE_MAX_THREADS ? nr_threads : POINTS_FILE_MAX_THREADS;
+    if ((uint64_t)nr_chunks * POINTS_FILE_MIN_CHUNK > (uint64_t)info.st_size) {
+        nr_chunks = (uint32_t)(info.st_size / POINTS_FILE_MIN_CHUNK) + 1;
+    }
+
+    // Cut at the first line start from every even split; chunks may come out empty
+    memset(chunks, 0, nr_chunks * sizeof(chunk_t));
+    chunks[0].begin = data;
+    for (uint32_t c = 1; c < nr_chunks; c++) {
+        const char *split = data + (uint64_t)info.st_size * c / nr_chunks;
+        if (split <= chunks[c - 1].begin) {
+            split = chunks[c - 1].begin;
+        } else {
+            split = end_of_line(split - 1, end);
+            split = split < end ? split + 1 : end;
+        }
+        chunks[c].begin = split;
+        chunks[c - 1].end = split;
+    }
+    for (uint32_t c = 0; c < nr_chunks; c++) {
+        chunks[c].points = points;
+        chunks[c].dims = dims;
+    }
+    chunks[nr_chunks - 1].end = end;
+
+    run_chunks(chunks, nr_chunks, count_rows);
+    for (uint32_t c = 0; c < nr_chunks; c++) {
+        chunks[c].first_row = rows;
+        chunks[c].first_line = lines;
+        rows += chunks[c].rows;
+        lines += chunks[c].lines;
+    }
+    if (rows > max_points) {
+        status = POINTS_FILE_ROWS;
+    } else {
+        run_chunks(chunks, nr_chunks, parse_rows);
+        // Report the error that comes first in the file
+        for (uint32_t c = 0; c < nr_chunks && status == POINTS_FILE_OK; c++) {
+            status = chunks[c].status;
+            result->line = chunks[c].error_line;
+        }
+    }
+
+    munmap((void *)data, info.st_size);
+    result->nr_points = (uint32_t)(rows < UINT32_MAX ? rows : UINT32_MAX);
+    return status;
+}
+
+const char *points_file_error(int status) {
+    switch (status) {
+    case POINTS_FILE_OK:
+        return "success";
+    case POINTS_FILE_OPEN:
+        return "cannot open the file";
+    case POINTS_FILE_ROWS:
+        return "too many rows";
+    case POINTS_FILE_COLUMNS:
+        return "wrong number of coordinates";
+    case POINTS_FILE_NUMBER:
+        return "malformed coordinate";
+    default:
+        return "unknown error";
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef _POINTSFILE_H_
+#define _POINTSFILE_H_
+
+#include <stdint.h>
+
+// Parallel loader for text point files such as points.txt (np.savetxt output:
+// one point per line, coordinates separated by spaces, tabs or commas, plain or
+// scientific notation). The file is mapped, cut at line boundaries into one
+// chunk per thread, and every thread parses its rows straight into their final
+// place in the caller's array. Numbers are parsed as in the C locale whatever
+// the process locale, so a decimal point is always '.'; other forms strtof()
+// accepts (hexadecimal) still read, but nan, inf and values beyond FLT_MAX are
+// errors, unlike the fscanf() loop this replaced. Blank lines are skipped.
+
+#define POINTS_FILE_MAX_THREADS 64
+#define POINTS_FILE_MIN_CHUNK (256 << 10)  // Smaller files use fewer threads
+
+enum points_file_status {
+    POINTS_FILE_OK = 0,
+    POINTS_FILE_OPEN = -1,     // Cannot open or map the file
+    POINTS_FILE_ROWS = -2,     // More rows than the array holds
+    POINTS_FILE_COLUMNS = -3,  // A row has more or fewer coordinates than dims
+    POINTS_FILE_NUMBER = -4,   // Malformed or non-finite coordinate
+};
+
+typedef struct {
+    uint32_t nr_points;  // Rows in the file, all read unless POINTS_FILE_ROWS
+    uint64_t line;       // POINTS_FILE_COLUMNS/NUMBER: first offending line, from 1
+} points_file_result_t;
+
+// Read up to max_points rows of dims floats into points (row-major) with
+// nr_threads threads, 0 for one per online CPU. Returns POINTS_FILE_OK or a
+// negative enum points_file_status; on error the array may be partly written.
+int points_file_load(const char *path, float *points, uint32_t max_points, uint32_t dims, uint32_t nr_threads,
+                     points_file_result_t *result);
+const char *points_file_error(int status);
+
+#endif
@@ -0,0 +1,2158 @@
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dpu.h>
+#include <dpu_management.h>
+
+#include "autotune.h"
+#include "session.h"
+
+// Like DPU_ASSERT, but a failed SDK call makes the calling function return
+// KMEANS_DPU_ERROR instead of exiting the process, which may be Python's
+#define DPU_CHECK(call)                                                          \
+    do {                                                                         \
+        dpu_error_t _status = (call);                                            \
+        if (_status != DPU_OK) {                                                 \
+            char *_message = dpu_error_to_string(_status);                       \
+            printf("Error: %s failed: %s\n", #call, _message ? _message : "?"); \
+            free(_message);                                                      \
+            return KMEANS_DPU_ERROR;                                             \
+        }                                                                        \
+    } while (0)
+
+// Count the working DPUs rank by rank: ranks can be partial (disabled DPUs)
+// and the simulator exposes a different count than the hardware
+static int count_dpus(struct dpu_set_t dpus, uint32_t *nr_dpus) {
+    struct dpu_set_t rank;
+    uint32_t nr_ranks, rank_id;
+
+    DPU_CHECK(dpu_get_nr_ranks(dpus, &nr_ranks));
+    DPU_CHECK(dpu_get_nr_dpus(dpus, nr_dpus));
+    printf("Allocated %u DPUs in %u ranks\n", *nr_dpus, nr_ranks);
+    DPU_RANK_FOREACH(dpus, rank, rank_id) {
+        uint32_t rank_dpus;
+        DPU_CHECK(dpu_get_nr_dpus(rank, &rank_dpus));
+        printf("  rank %u: %u DPUs\n", rank_id, rank_dpus);
+    }
+
+    return KMEANS_OK;
+}
+
+// Grow a host buffer kept across jobs; NULL (and an empty buffer) if it cannot
+static void *reserve(void *buffer, size_t *capacity, size_t size) {
+    if (size > *capacity) {
+        free(buffer);
+        *capacity = 0;
+        buffer = malloc(size);
+        if (!buffer) {
+            printf("Error: cannot allocate %zu bytes\n", size);
+            return NULL;
+        }
+        *capacity = size;
+    }
+    return buffer;
+}
+
+// NUMA node of a rank, looked up by the id the SDK's rank handle carries (the
+// driver's /dev/dpu_rank<id>), not by the rank's order in the set: the set may
+// hold only some ranks, and other processes may hold lower-numbered ones
+static int rank_node(struct dpu_set_t rank) {
+    struct dpu_set_t dpu;
+    uint32_t i;
+
+    DPU_FOREACH(rank, dpu, i) {
+        struct dpu_rank_t *handle = dpu_get_rank(dpu_from_set(dpu));
+        return handle ? hostmem_rank_node(dpu_get_rank_id(handle)) : -1;
+    }
+    return -1;
+}
+
+// Rank of every DPU and NUMA node of every rank
+// Workers for fill_staging() and the host reduction, one per rank on its node
+static int start_pool(kmeans_session_t *session) {
+    int *nodes = malloc(session->nr_ranks * sizeof(int));
+
+    for (uint32_t r = 0; nodes && r < session->nr_ranks; r++) {
+        nodes[r] = session->ranks[r].node;
+    }
+    session->pool = nodes ? hostmem_pool_create(session->nr_ranks, nodes) : NULL;
+    free(nodes);
+    if (!session->pool) {
+        printf("Error: cannot start the host worker threads\n");
+        return KMEANS_NO_MEMORY;
+    }
+    return KMEANS_OK;
+}
+
+static int init_ranks(kmeans_session_t *session) {
+    struct dpu_set_t rank;
+    uint32_t rank_id, first = 0;
+
+    DPU_CHECK(dpu_get_nr_ranks(session->dpus, &session->nr_ranks));
+    session->ranks = calloc(session->nr_ranks, sizeof(host_rank_t));
+    session->dpu_rank = malloc(session->nr_dpus * sizeof(uint32_t));
+    if (!session->ranks || !session->dpu_rank) {
+        printf("Error: cannot allocate host buffers for %u DPUs\n", session->nr_dpus);
+        return KMEANS_NO_MEMORY;
+    }
+    DPU_RANK_FOREACH(session->dpus, rank, rank_id) {
+        host_rank_t *host = &session->ranks[rank_id];
+        DPU_CHECK(dpu_get_nr_dpus(rank, &host->nr_dpus));
+        host->node = rank_node(rank);
+        host->first_dpu = first;
+        for (uint32_t i = 0; i < host->nr_dpus; i++) {
+            session->dpu_rank[first + i] = rank_id;
+        }
+        first += host->nr_dpus;
+    }
+    return start_pool(session);
+}
+
+// Make room for shard_bytes per DPU in the staging of every rank, on its node
+static int reserve_staging(kmeans_session_t *session, size_t shard_bytes) {
+    for (uint32_t r = 0; r < session->nr_ranks; r++) {
+        host_rank_t *host = &session->ranks[r];
+        size_t size = host->nr_dpus * shard_bytes;
+        if (size > host->staging_size) {
+            hostmem_free(host->staging, host->staging_size);
+            host->staging = hostmem_alloc(size, host->node, &host->staging_size);
+            if (!host->staging) {
+                printf("Error: cannot allocate %zu bytes\n", size);
+                host->staging_size = 0;
+                return KMEANS_NO_MEMORY;
+            }
+        }
+    }
+    return KMEANS_OK;
+}
+
+// Shard of DPU i in the staging, with shard_bytes per DPU
+static uint8_t *staged_shard(const kmeans_session_t *session, uint32_t i, size_t shard_bytes) {
+    const host_rank_t *host = &session->ranks[session->dpu_rank[i]];
+    return host->staging + (i - host->first_dpu) * shard_bytes;
+}
+
+typedef struct {
+    kmeans_session_t *session;
+    void (*fill)(kmeans_session_t *session, const void *context, uint32_t dpu);
+    const void *context;
+} staging_pass_t;
+
+static void fill_rank(void *arg, uint32_t rank) {
+    staging_pass_t *pass = arg;
+    host_rank_t *host = &pass->session->ranks[rank];
+
+    for (uint32_t i = host->first_dpu; i < host->first_dpu + host->nr_dpus; i++) {
+        pass->fill(pass->session, pass->context, i);
+    }
+}
+
+// Fill the staged shard of every DPU, each rank from a thread on the rank's node
+static void fill_staging(kmeans_session_t *session, void (*fill)(kmeans_session_t *, const void *, uint32_t),
+                         const void *context) {
+    staging_pass_t pass = {session, fill, context};
+    int *nodes = malloc(session->nr_ranks * sizeof(int));
+
+    if (!nodes) {
+        for (uint32_t r = 0; r < session->nr_ranks; r++) {
+            fill_rank(&pass, r);
+        }
+        return;
+    }
+    for (uint32_t r = 0; r < session->nr_ranks; r++) {
+        nodes[r] = session->ranks[r].node;
+    }
+    hostmem_pool_run(session->pool, session->nr_ranks, nodes, fill_rank, &pass);
+    free(nodes);
+}
+
+// Balance the points over the available DPUs: shard sizes differ by at most
+// one point, and all shards are padded to the same SHARD_ALIGN multiple.
+// With several groups, every group of DPUs holds its own copy of the points.
+static int plan_shards(shard_layout_t *layout, uint32_t nr_points, uint32_t dims, uint32_t nr_groups) {
+    uint32_t group_size = layout->nr_dpus / nr_groups;
+    uint32_t base = nr_points / group_size;
+    uint32_t extra = nr_points % group_size;
+
+    layout->nr_groups = nr_groups;
+    layout->group_size = group_size;
+    for (uint32_t i = 0; i < layout->nr_dpus; i++) {
+        uint32_t position = i % group_size;
+        if (i >= nr_groups * group_size) {
+            // Left over DPUs run with an empty shard
+            layout->offsets[i] = 0;
+            layout->sizes[i] = 0;
+            continue;
+        }
+        layout->offsets[i] = position * base + (position < extra ? position : extra);
+        layout->sizes[i] = base + (position < extra ? 1 : 0);
+    }
+    layout->nr_padded = ALIGN_UP(base + (extra ? 1 : 0), SHARD_ALIGN);
+    if (layout->nr_padded == 0) {
+        layout->nr_padded = SHARD_ALIGN;
+    }
+
+    if (layout->nr_padded > MAX_POINTS_PER_DPU || (uint64_t)layout->nr_padded * dims > MAX_POINT_FLOATS) {
+        printf("Error: %u points per DPU do not fit in MRAM\n", layout->nr_padded);
+        return -1;
+    }
+    return 0;
+}
+
+// Pick per-dimension offset and scale mapping the job's range onto uint16
+static void quantization_params(const kmeans_job_t *job, dpu_quantization_t *quantization) {
+    for (uint32_t d = 0; d < job->dims; d++) {
+        float min = job->points[d], max = job->points[d];
+        for (uint32_t i = 1; i < job->nr_points; i++) {
+            float x = job->points[(size_t)i * job->dims + d];
+            min = x < min ? x : min;
+            max = x > max ? x : max;
+        }
+        quantization->offset[d] = min;
+        quantization->scale[d] = max > min ? (max - min) / UINT16_MAX : 1.0f;
+    }
+}
+
+static void quantize(uint16_t *out, const float *in, size_t count, uint32_t dims, const dpu_quantization_t *quantization) {
+    for (size_t i = 0; i < count; i++) {
+        uint32_t d = i % dims;
+        float q = (in[i] - quantization->offset[d]) / quantization->scale[d] + 0.5f;
+        out[i] = q < 0.0f ? 0 : q > UINT16_MAX ? UINT16_MAX : (uint16_t)q;
+    }
+}
+
+typedef struct {
+    uint64_t code;
+    uint32_t index;
+} morton_key_t;
+
+static int compare_morton(const void *a, const void *b) {
+    const morton_key_t *x = a, *y = b;
+    if (x->code != y->code) {
+        return x->code < y->code ? -1 : 1;
+    }
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+// Sort the points along a Z-order curve into session->sorted, keeping the
+// permutation in session->order. Every coordinate is scaled to 16 bits over its
+// range and the top 64 / dims bits of all dimensions are interleaved, so points
+// close on the curve are close in space and every tile gets a tight box.
+static int sort_spatially(kmeans_session_t *session, const kmeans_job_t *job) {
+    uint32_t dims = job->dims;
+    uint32_t bits = 64 / dims < 16 ? 64 / dims : 16;
+    dpu_quantization_t range;
+    uint16_t *grid = malloc((size_t)job->nr_points * dims * sizeof(uint16_t));
+    morton_key_t *keys = malloc(job->nr_points * sizeof(morton_key_t));
+
+    session->order = reserve(session->order, &session->order_size, job->nr_points * sizeof(uint32_t));
+    session->sorted = reserve(session->sorted, &session->sorted_size, (size_t)job->nr_points * dims * sizeof(float));
+    if (!grid || !keys || !session->order || !session->sorted) {
+        printf("Error: cannot allocate the spatial order of %u points\n", job->nr_points);
+        free(grid);
+        free(keys);
+        return KMEANS_NO_MEMORY;
+    }
+    quantization_params(job, &range);
+    quantize(grid, job->points, (size_t)job->nr_points * dims, dims, &range);
+    for (uint32_t i = 0; i < job->nr_points; i++) {
+        uint64_t code = 0;
+        for (uint32_t b = 0; b < bits; b++) {
+            for (uint32_t d = 0; d < dims; d++) {
+                code = code << 1 | ((grid[(size_t)i * dims + d] >> (15 - b)) & 1);
+            }
+        }
+        keys[i].code = code;
+        keys[i].index = i;
+    }
+    qsort(keys, job->nr_points, sizeof(morton_key_t), compare_morton);
+
+    for (uint32_t i = 0; i < job->nr_points; i++) {
+        session->order[i] = keys[i].index;
+        memcpy(&session->sorted[(size_t)i * dims], &job->points[(size_t)keys[i].index * dims], dims * sizeof(float));
+    }
+
+    free(grid);
+    free(keys);
+    return KMEANS_OK;
+}
+
+static uint32_t reverse_bits(uint32_t x, uint32_t bits) {
+    uint32_t r = 0;
+    for (uint32_t b = 0; b < bits; b++) {
+        r = r << 1 | ((x >> b) & 1);
+    }
+    return r;
+}
+
+// Reorder every shard so that any prefix of it is a stratified sample of it:
+// shard positions are taken in bit-reversed order, so the first 2^j points of
+// a shard are evenly spaced over its range. Same permutation and buffers as
+// sort_spatially; every group of DPUs shares the shards of the first one.
+static int stratify_shards(kmeans_session_t *session, const kmeans_job_t *job) {
+    shard_layout_t *layout = &session->layout;
+    uint32_t dims = job->dims;
+
+    session->order = reserve(session->order, &session->order_size, job->nr_points * sizeof(uint32_t));
+    session->sorted = reserve(session->sorted, &session->sorted_size, (size_t)job->nr_points * dims * sizeof(float));
+    if (!session->order || !session->sorted) {
+        return KMEANS_NO_MEMORY;
+    }
+    for (uint32_t i = 0; i < layout->group_size; i++) {
+        uint32_t offset = layout->offsets[i], size = layout->sizes[i], bits = 0, slot = offset;
+        while ((1u << bits) < size) {
+            bits++;
+        }
+        for (uint32_t r = 0; r < (1u << bits) && size > 0; r++) {
+            uint32_t position = reverse_bits(r, bits);
+            if (position < size) {
+                session->order[slot] = offset + position;
+                memcpy(&session->sorted[(size_t)slot * dims], &job->points[((size_t)offset + position) * dims],
+                       dims * sizeof(float));
+                slot++;
+            }
+        }
+    }
+    return KMEANS_OK;
+}
+
+// Tiles of at most one block, small enough that every tasklet gets some
+static uint32_t tile_size(uint32_t nr_padded, uint32_t dims, uint32_t block_bytes) {
+    uint32_t tile = nr_padded / TILES_PER_SHARD / SHARD_ALIGN * SHARD_ALIGN;
+    uint32_t per_block = points_per_block(dims, block_bytes);
+
+    return tile < SHARD_ALIGN ? SHARD_ALIGN : tile > per_block ? per_block : tile;
+}
+
+// Bounding box of every tile of every shard, over the coordinates the DPU
+// actually reads (dequantized for POINTS_UINT16), pushed in one transfer
+static int transfer_tile_bounds(kmeans_session_t *session, const kmeans_job_t *job, uint32_t tile_points,
+                                const dpu_quantization_t *quantization) {
+    shard_layout_t *layout = &session->layout;
+    struct dpu_set_t dpu;
+    uint32_t i, dims = job->dims;
+    uint32_t nr_tiles = ALIGN_UP(layout->nr_padded, tile_points) / tile_points;
+    size_t shard_count = (size_t)layout->nr_padded * dims;
+    size_t shard_bounds = (size_t)nr_tiles * 2 * dims;
+    size_t coordinate_bytes = job->format == POINTS_UINT16 ? sizeof(uint16_t) : sizeof(float);
+
+    session->bounds = reserve(session->bounds, &session->bounds_size, layout->nr_dpus * shard_bounds * sizeof(float));
+    if (!session->bounds) {
+        return KMEANS_NO_MEMORY;
+    }
+    for (i = 0; i < layout->nr_dpus; i++) {
+        const uint8_t *shard = staged_shard(session, i, shard_count * coordinate_bytes);
+        for (uint32_t t = 0; t < nr_tiles; t++) {
+            float *low = &session->bounds[i * shard_bounds + (size_t)t * 2 * dims], *high = low + dims;
+            uint32_t first = t * tile_points;
+            uint32_t end = first + tile_points < layout->sizes[i] ? first + tile_points : layout->sizes[i];
+
+            // Tiles without real points are never scanned
+            memset(low, 0, 2 * dims * sizeof(float));
+            for (uint32_t p = first; p < end; p++) {
+                for (uint32_t d = 0; d < dims; d++) {
+                    size_t index = (size_t)p * dims + d;
+                    float x = job->format == POINTS_UINT16
+                                  ? quantization->offset[d] + quantization->scale[d] * ((const uint16_t *)shard)[index]
+                                  : ((const float *)shard)[index];
+                    low[d] = p == first || x < low[d] ? x : low[d];
+                    high[d] = p == first || x > high[d] ? x : high[d];
+                }
+            }
+        }
+    }
+
+    DPU_FOREACH(session->dpus, dpu, i) {
+        DPU_CHECK(dpu_prepare_xfer(dpu, &session->bounds[i * shard_bounds]));
+    }
+    DPU_CHECK(dpu_push_xfer(session->dpus, DPU_XFER_TO_DPU, "tile_bounds", 0, shard_bounds * sizeof(float), DPU_XFER_DEFAULT));
+    return KMEANS_OK;
+}
+
+static int push_args(kmeans_session_t *session) {
+    struct dpu_set_t dpu;
+    uint32_t i;
+
+    DPU_FOREACH(session->dpus, dpu, i) {
+        DPU_CHECK(dpu_prepare_xfer(dpu, &session->args[i]));
+    }
+    DPU_CHECK(dpu_push_xfer(session->dpus, DPU_XFER_TO_DPU, "DPU_INPUT_ARGUMENTS", 0, sizeof(dpu_arguments_t), DPU_XFER_DEFAULT));
+    return KMEANS_OK;
+}
+
+// MODE_STEP arguments of every DPU for the job's shards
+static void init_args(kmeans_session_t *session, const kmeans_job_t *job, uint32_t tile_points) {
+    shard_layout_t *layout = &session->layout;
+    dpu_arguments_t *args = session->args;
+
+    for (uint32_t i = 0; i < layout->nr_dpus; i++) {
+        args[i].nr_points = layout->sizes[i];
+        args[i].nr_padded = layout->nr_padded;
+        args[i].dims = job->dims;
+        args[i].k = job->k;
+        args[i].mode = MODE_STEP;
+        args[i].max_iterations = 1;
+        args[i].format = job->format;
+        args[i].tile_points = tile_points;
+        args[i].want_distances = 0;
+        args[i].track_bounds = job->incremental;
+        args[i].bounded_points = 0;
+        args[i].first_point = layout->offsets[i];
+        args[i].block_bytes = session->block_bytes;
+        args[i].reserved = 0;
+    }
+}
+
+// Generated jobs: every DPU fills its own shard (its group's copy with several
+// groups) in one launch, then the arguments switch to MODE_STEP
+static int generate_shards(kmeans_session_t *session, const kmeans_job_t *job) {
+    int status;
+
+    session->resident = NULL;
+    DPU_CHECK(dpu_broadcast_to(session->dpus, "generator", 0, job->generator, sizeof(dpu_generator_t), DPU_XFER_DEFAULT));
+    init_args(session, job, 0);
+    for (uint32_t i = 0; i < session->nr_dpus; i++) {
+        session->args[i].mode = MODE_GENERATE;
+    }
+    if ((status = push_args(session)) != KMEANS_OK) {
+        return status;
+    }
+    DPU_CHECK(dpu_launch(session->dpus, DPU_SYNCHRONOUS));
+
+    for (uint32_t i = 0; i < session->nr_dpus; i++) {
+        session->args[i].mode = MODE_STEP;
+    }
+    return push_args(session);
+}
+
+typedef struct {
+    const kmeans_job_t *job;
+    const dpu_quantization_t *quantization;
+    size_t shard_bytes;
+} shard_copy_t;
+
+static void copy_shard(kmeans_session_t *session, const void *context, uint32_t i) {
+    const shard_copy_t *copy = context;
+    const kmeans_job_t *job = copy->job;
+    uint8_t *shard = staged_shard(session, i, copy->shard_bytes);
+    const float *first = &job->points[(size_t)session->layout.offsets[i] * job->dims];
+    size_t count = (size_t)session->layout.sizes[i] * job->dims;
+    size_t coordinate_bytes = job->format == POINTS_UINT16 ? sizeof(uint16_t) : sizeof(float);
+
+    if (job->format == POINTS_UINT16) {
+        quantize((uint16_t *)shard, first, count, job->dims, copy->quantization);
+    } else {
+        memcpy(shard, first, count * sizeof(float));
+    }
+    memset(shard + count * coordinate_bytes, 0, copy->shard_bytes - count * coordinate_bytes);
+}
+
+// Copy every shard into a padded staging buffer and push them in one parallel
+// transfer. The sentinel tail is never assigned nor summed by the DPU.
+static int transfer_shards(kmeans_session_t *session, const kmeans_job_t *job) {
+    shard_layout_t *layout = &session->layout;
+    struct dpu_set_t dpu;
+    uint32_t i;
+    size_t coordinate_bytes = job->format == POINTS_UINT16 ? sizeof(uint16_t) : sizeof(float);
+    size_t shard_bytes = (size_t)layout->nr_padded * job->dims * coordinate_bytes;
+    dpu_quantization_t quantization = {{0}, {0}};
+    uint32_t tile_points = job->spatial_order ? tile_size(layout->nr_padded, job->dims, session->block_bytes) : 0;
+    shard_copy_t copy = {job, &quantization, shard_bytes};
+    int status;
+
+    session->resident = NULL;
+    if (job->format == POINTS_UINT16) {
+        quantization_params(job, &quantization);
+        DPU_CHECK(dpu_broadcast_to(session->dpus, "quantization", 0, &quantization, sizeof(quantization), DPU_XFER_DEFAULT));
+    }
+
+    if ((status = reserve_staging(session, shard_bytes)) != KMEANS_OK) {
+        return status;
+    }
+    fill_staging(session, copy_shard, &copy);
+
+    DPU_FOREACH(session->dpus, dpu, i) {
+        DPU_CHECK(dpu_prepare_xfer(dpu, staged_shard(session, i, shard_bytes)));
+    }
+    DPU_CHECK(dpu_push_xfer(session->dpus, DPU_XFER_TO_DPU, "points", 0, shard_bytes, DPU_XFER_DEFAULT));
+    if (tile_points && (status = transfer_tile_bounds(session, job, tile_points, &quantization)) != KMEANS_OK) {
+        return status;
+    }
+    init_args(session, job, tile_points);
+    return push_args(session);
+}
+
+// Send each group its current centroids. Group g's centroids start at
+// centroids[g * stride], stride being the 8-byte padded size of one set.
+static int push_centroids(kmeans_session_t *session, float *centroids, uint32_t stride) {
+    shard_layout_t *layout = &session->layout;
+    struct dpu_set_t dpu;
+    uint32_t i;
+
+    session->model_k = 0;
+
+    if (layout->nr_groups == 1) {
+        DPU_CHECK(dpu_broadcast_to(session->dpus, "centroids", 0, centroids, stride * sizeof(float), DPU_XFER_DEFAULT));
+        return KMEANS_OK;
+    }
+    DPU_FOREACH(session->dpus, dpu, i) {
+        uint32_t group = i < layout->nr_groups * layout->group_size ? i / layout->group_size : 0;
+        DPU_CHECK(dpu_prepare_xfer(dpu, &centroids[group * stride]));
+    }
+    DPU_CHECK(dpu_push_xfer(session->dpus, DPU_XFER_TO_DPU, "centroids", 0, stride * sizeof(float), DPU_XFER_DEFAULT));
+    return KMEANS_OK;
+}
+
+// Fraction of every shard the given iteration assigns under the job's
+// schedule; the last iteration is always a full pass, so the labels cover every point
+static float stage_fraction(const kmeans_job_t *job, uint32_t iteration) {
+    uint32_t end = 0;
+
+    for (uint32_t stage = 0; stage < job->nr_stages; stage++) {
+        end += job->schedule[stage].iterations;
+        if (iteration < end && iteration + 1 < job->max_iterations) {
+            return job->schedule[stage].fraction;
+        }
+    }
+    return 1.0f;
+}
+
+// Make the next passes assign the first fraction of every shard, rounded up
+// to whole points; sampled gets the points assigned per group
+static int sample_shards(kmeans_session_t *session, float fraction, uint32_t *sampled) {
+    shard_layout_t *layout = &session->layout;
+
+    *sampled = 0;
+    for (uint32_t i = 0; i < session->nr_dpus; i++) {
+        uint32_t n = (uint32_t)ceil((double)fraction * layout->sizes[i]);
+        session->args[i].nr_points = n < layout->sizes[i] ? n : layout->sizes[i];
+        *sampled += i < layout->group_size ? session->args[i].nr_points : 0;
+    }
+    return push_args(session);
+}
+
+// Coordinate bytes one assignment pass reads from MRAM, over all DPUs
+static uint64_t pass_bytes(const kmeans_session_t *session) {
+    uint64_t bytes = 0;
+
+    for (uint32_t i = 0; i < session->nr_dpus; i++) {
+        const dpu_arguments_t *args = &session->args[i];
+        size_t coordinate_bytes = args->format == POINTS_UINT16 ? sizeof(uint16_t) : sizeof(float);
+        bytes += (uint64_t)ALIGN_UP(args->nr_points, SHARD_ALIGN) * args->dims * coordinate_bytes;
+    }
+    return bytes;
+}
+
+// One run of consecutive DPUs of the same rank and group, reduced by one thread
+typedef struct {
+    uint32_t first_dpu, end_dpu;
+    uint32_t group;
+    int node;
+} reduce_segment_t;
+
+typedef struct {
+    const float *sums;            // Partial sums of every DPU, sums_len floats apart
+    const uint8_t *results;       // dpu_step_result_t of every DPU, result_bytes apart
+    uint32_t sums_len, result_bytes;
+    uint32_t k, kd;               // kd = k * dims floats per partial
+    const reduce_segment_t *segments;
+    uint32_t nr_segments;
+    uint32_t nr_groups;
+    const uint32_t *group_segments;  // Segments of group g are [group_segments[g], group_segments[g + 1])
+    double *acc;                  // kd doubles per segment, then the group totals in place
+    double *compensation;         // kd doubles per segment with Kahan summation, else NULL
+    uint64_t *counts;             // k per segment
+    uint32_t slice;               // Floats of kd per combine task
+} reduce_pass_t;
+
+// Leaf: sum the partials of a segment's DPUs into its accumulators
+static void reduce_segment(void *arg, uint32_t s) {
+    const reduce_pass_t *pass = arg;
+    const reduce_segment_t *segment = &pass->segments[s];
+    double *restrict acc = &pass->acc[(size_t)s * pass->kd];
+    uint64_t *restrict counts = &pass->counts[(size_t)s * pass->k];
+    uint32_t kd = pass->kd;
+
+    memset(acc, 0, kd * sizeof(double));
+    memset(counts, 0, pass->k * sizeof(uint64_t));
+    if (pass->compensation) {
+        double *restrict c = &pass->compensation[(size_t)s * kd];
+        memset(c, 0, kd * sizeof(double));
+        for (uint32_t i = segment->first_dpu; i < segment->end_dpu; i++) {
+            const float *restrict src = &pass->sums[(size_t)i * pass->sums_len];
+            for (uint32_t x = 0; x < kd; x++) {
+                double y = src[x] - c[x];
+                double t = acc[x] + y;
+                c[x] = (t - acc[x]) - y;
+                acc[x] = t;
+            }
+        }
+        for (uint32_t x = 0; x < kd; x++) {
+            acc[x] -= c[x];
+        }
+    } else {
+        for (uint32_t i = segment->first_dpu; i < segment->end_dpu; i++) {
+            const float *restrict src = &pass->sums[(size_t)i * pass->sums_len];
+            for (uint32_t x = 0; x < kd; x++) {
+                acc[x] += src[x];
+            }
+        }
+    }
+    for (uint32_t i = segment->first_dpu; i < segment->end_dpu; i++) {
+        const dpu_step_result_t *result = (const dpu_step_result_t *)&pass->results[(size_t)i * pass->result_bytes];
+        for (uint32_t j = 0; j < pass->k; j++) {
+            counts[j] += result->counts[j];
+        }
+    }
+}
+
+// Tree: fold the segments of every group pairwise into the group's first
+// segment, over one slice of the kd floats; slices are disjoint
+static void combine_segments(void *arg, uint32_t task) {
+    const reduce_pass_t *pass = arg;
+    uint32_t lo = task * pass->slice;
+    uint32_t hi = lo + pass->slice < pass->kd ? lo + pass->slice : pass->kd;
+
+    for (uint32_t g = 0; g < pass->nr_groups; g++) {
+        uint32_t first = pass->group_segments[g], n = pass->group_segments[g + 1] - first;
+        for (uint32_t step = 1; step < n; step *= 2) {
+            for (uint32_t a = 0; a + step < n; a += 2 * step) {
+                double *restrict dst = &pass->acc[(size_t)(first + a) * pass->kd];
+                const double *restrict src = &pass->acc[(size_t)(first + a + step) * pass->kd];
+                for (uint32_t x = lo; x < hi; x++) {
+                    dst[x] += src[x];
+                }
+            }
+        }
+    }
+}
+
+// Run fn over nr_tasks, on the session's workers (on the node nodes says) or
+// inline; both give the same sums since every task owns its outputs
+static void run_reduce(kmeans_session_t *session, uint32_t nr_tasks, const int *nodes, int parallel,
+                       void (*fn)(void *, uint32_t), void *arg) {
+    if (parallel && nr_tasks > 1) {
+        hostmem_pool_run(session->pool, nr_tasks, nodes, fn, arg);
+    } else {
+        for (uint32_t t = 0; t < nr_tasks; t++) {
+            fn(arg, t);
+        }
+    }
+}
+
+// Sum the partials of every group into new_centroids (nr_groups x kd) and
+// count (nr_groups x k). DPUs are cut into segments at rank and group
+// boundaries; each segment is reduced on a thread of its rank's node, then the
+// segments of a group are combined pairwise, the kd floats split over threads.
+static int reduce_partials(kmeans_session_t *session, const float *sums, uint32_t sums_len, uint32_t result_bytes,
+                           uint32_t k, uint32_t dims, int compensated, double *new_centroids, uint64_t *count) {
+    shard_layout_t *layout = &session->layout;
+    uint32_t nr_used = layout->nr_groups * layout->group_size;
+    uint32_t max_segments = session->nr_ranks + layout->nr_groups;
+    reduce_segment_t *segments = malloc(max_segments * sizeof(reduce_segment_t));
+    uint32_t *group_segments = malloc((layout->nr_groups + 1) * sizeof(uint32_t));
+    int *nodes = malloc(max_segments * sizeof(int));
+    reduce_pass_t pass = {sums, session->partial_results, sums_len, result_bytes, k, k * dims, segments, 0,
+                          layout->nr_groups, group_segments, NULL, NULL, NULL, 0};
+    size_t acc_floats, acc_bytes;
+    int parallel, known = 0;
+
+    if (!segments || !group_segments || !nodes) {
+        printf("Error: cannot allocate the reduction segments\n");
+        free(segments);
+        free(group_segments);
+        free(nodes);
+        return KMEANS_NO_MEMORY;
+    }
+    for (uint32_t i = 0; i < nr_used; i++) {
+        uint32_t group = i / layout->group_size;
+        if (i == 0 || group != segments[pass.nr_segments - 1].group ||
+            session->dpu_rank[i] != session->dpu_rank[i - 1]) {
+            if (i == 0 || group != segments[pass.nr_segments - 1].group) {
+                group_segments[group] = pass.nr_segments;
+            }
+            segments[pass.nr_segments++] =
+                (reduce_segment_t){i, i + 1, group, session->ranks[session->dpu_rank[i]].node};
+        } else {
+            segments[pass.nr_segments - 1].end_dpu = i + 1;
+        }
+    }
+    group_segments[layout->nr_groups] = pass.nr_segments;
+    for (uint32_t s = 0; s < pass.nr_segments; s++) {
+        nodes[s] = segments[s].node;
+        known |= nodes[s] >= 0;
+    }
+
+    acc_floats = (size_t)pass.nr_segments * pass.kd * (compensated ? 2 : 1);
+    acc_bytes = acc_floats * sizeof(double) + (size_t)pass.nr_segments * k * sizeof(uint64_t);
+    session->reduce_buffer = reserve(session->reduce_buffer, &session->reduce_buffer_size, acc_bytes);
+    if (!session->reduce_buffer) {
+        free(segments);
+        free(group_segments);
+        free(nodes);
+        return KMEANS_NO_MEMORY;
+    }
+    pass.acc = session->reduce_buffer;
+    pass.compensation = compensated ? pass.acc + (size_t)pass.nr_segments * pass.kd : NULL;
+    pass.counts = (uint64_t *)(pass.acc + acc_floats);
+    pass.slice = pass.kd < REDUCE_SLICE_FLOATS ? pass.kd : REDUCE_SLICE_FLOATS;
+
+    parallel = (uint64_t)nr_used * pass.kd >= REDUCE_PARALLEL_FLOATS;
+    run_reduce(session, pass.nr_segments, known ? nodes : NULL, parallel, reduce_segment, &pass);
+    run_reduce(session, (pass.kd + pass.slice - 1) / pass.slice, NULL, parallel, combine_segments, &pass);
+
+    for (uint32_t group = 0; group < layout->nr_groups; group++) {
+        uint32_t first = group_segments[group];
+        memcpy(&new_centroids[(size_t)group * pass.kd], &pass.acc[(size_t)first * pass.kd], pass.kd * sizeof(double));
+        for (uint32_t s = first; s < group_segments[group + 1]; s++) {
+            for (uint32_t j = 0; j < k; j++) {
+                count[group * k + j] += pass.counts[(size_t)s * k + j];
+            }
+        }
+    }
+
+    free(segments);
+    free(group_segments);
+    free(nodes);
+    return KMEANS_OK;
+}
+
+// Far point of one DPU's tasklet, for sorting a group's candidates
+typedef struct {
+    float distance;
+    uint32_t slot;  // DPU x MAX_FAR_POINTS + tasklet
+} far_candidate_t;
+
+// Farthest first, then in DPU order so the result does not depend on qsort
+static int compare_far(const void *a, const void *b) {
+    const far_candidate_t *x = a, *y = b;
+    if (x->distance != y->distance) {
+        return x->distance > y->distance ? -1 : 1;
+    }
+    return x->slot < y->slot ? -1 : x->slot > y->slot;
+}
+
+// Move every empty cluster of each group onto the farthest points the group's
+// DPUs reported (see dpu_far_point_t), farthest first, taking each point out of
+// its cluster's sums; a cluster never gives up its last point. Clusters still
+// empty, for lack of candidates, are retried the next iteration. The number
+// of clusters moved is added to moved.
+static int relocate_empty_clusters(kmeans_session_t *session, uint32_t k, uint32_t dims, double *new_centroids,
+                                   uint64_t *count, uint32_t *moved) {
+    shard_layout_t *layout = &session->layout;
+    uint32_t stride = ALIGN8(dims * sizeof(float)) / sizeof(float);
+    size_t far_bytes = ALIGN8(MAX_FAR_POINTS * sizeof(dpu_far_point_t)) + MAX_FAR_POINTS * stride * sizeof(float);
+    uint32_t nr_empty = 0;
+    far_candidate_t *candidates;
+    struct dpu_set_t dpu;
+    uint32_t i;
+
+    for (uint32_t j = 0; j < layout->nr_groups * k; j++) {
+        nr_empty += count[j] == 0;
+    }
+    if (nr_empty == 0) {
+        return KMEANS_OK;
+    }
+
+    // Read only now: most iterations have no empty cluster
+    session->far_buffer = reserve(session->far_buffer, &session->far_buffer_size, session->nr_dpus * far_bytes);
+    if (!session->far_buffer) {
+        return KMEANS_NO_MEMORY;
+    }
+    DPU_FOREACH(session->dpus, dpu, i) {
+        DPU_CHECK(dpu_prepare_xfer(dpu, &session->far_buffer[(size_t)i * far_bytes]));
+    }
+    DPU_CHECK(dpu_push_xfer(session->dpus, DPU_XFER_FROM_DPU, "far_points", 0,
+                            ALIGN8(MAX_FAR_POINTS * sizeof(dpu_far_point_t)), DPU_XFER_DEFAULT));
+    DPU_FOREACH(session->dpus, dpu, i) {
+        DPU_CHECK(dpu_prepare_xfer(
+            dpu, &session->far_buffer[(size_t)i * far_bytes + ALIGN8(MAX_FAR_POINTS * sizeof(dpu_far_point_t))]));
+    }
+    DPU_CHECK(dpu_push_xfer(session->dpus, DPU_XFER_FROM_DPU, "far_coordinates", 0,
+                            MAX_FAR_POINTS * stride * sizeof(float), DPU_XFER_DEFAULT));
+
+    candidates = malloc((size_t)layout->group_size * MAX_FAR_POINTS * sizeof(far_candidate_t));
+    if (!candidates) {
+        printf("Error: cannot allocate the far point candidates\n");
+        return KMEANS_NO_MEMORY;
+    }
+    for (uint32_t group = 0; group < layout->nr_groups; group++) {
+        double *sums = &new_centroids[(size_t)group * k * dims];
+        uint64_t *group_count = &count[(size_t)group * k];
+        uint32_t nr_candidates = 0, next = 0;
+
+        for (i = group * layout->group_size; i < (group + 1) * layout->group_size; i++) {
+            const dpu_far_point_t *far = (const dpu_far_point_t *)&session->far_buffer[(size_t)i * far_bytes];
+            for (uint32_t t = 0; t < MAX_FAR_POINTS; t++) {
+                if (far[t].distance > 0.0f && far[t].label < k) {
+                    candidates[nr_candidates++] = (far_candidate_t){far[t].distance, i * MAX_FAR_POINTS + t};
+                }
+            }
+        }
+        qsort(candidates, nr_candidates, sizeof(far_candidate_t), compare_far);
+
+        for (uint32_t j = 0; j < k; j++) {
+            if (group_count[j] != 0) {
+                continue;
+            }
+            for (; next < nr_candidates; next++) {
+                uint32_t dpu_index = candidates[next].slot / MAX_FAR_POINTS, t = candidates[next].slot % MAX_FAR_POINTS;
+                const uint8_t *far_data = &session->far_buffer[(size_t)dpu_index * far_bytes];
+                uint32_t label = ((const dpu_far_point_t *)far_data)[t].label;
+                const float *x = (const float *)(far_data + ALIGN8(MAX_FAR_POINTS * sizeof(dpu_far_point_t))) +
+                                 (size_t)t * stride;
+                if (group_count[label] > 1) {
+                    for (uint32_t d = 0; d < dims; d++) {
+                        sums[(size_t)label * dims + d] -= x[d];
+                        sums[(size_t)j * dims + d] = x[d];
+                    }
+                    group_count[label]--;
+                    group_count[j] = 1;
+                    (*moved)++;
+                    next++;
+                    break;
+                }
+            }
+        }
+    }
+    free(candidates);
+    return KMEANS_OK;
+}
+
+// Merge the per-DPU partial sums of each group, move its empty clusters onto
+// far points, and move every non-empty centroid of the group to its mean. The inertia of the assignment pass the
+// partials come from is summed per group into inertia[].
+static int update_centroids(kmeans_session_t *session, kmeans_job_t *job, float *centroids, uint32_t stride,
+                            double *inertia) {
+    shard_layout_t *layout = &session->layout;
+    struct dpu_set_t dpu;
+    uint32_t i;
+    uint32_t k = job->k, dims = job->dims;
+    uint32_t sums_len = ALIGN8(k * dims * sizeof(float)) / sizeof(float);
+    uint32_t result_bytes = ALIGN8(offsetof(dpu_step_result_t, counts) + k * sizeof(uint32_t));
+    float *sums;
+    double *new_centroids;
+    uint64_t *count;
+    uint64_t cycles = 0;  // Of the slowest DPU
+    uint64_t phase_cycles[NR_DPU_PHASES] = {0};  // Of the slowest DPU in each phase
+    int status;
+
+    session->partial_sums = reserve(session->partial_sums, &session->partial_sums_size,
+                                    (size_t)session->nr_dpus * sums_len * sizeof(float));
+    session->partial_results = reserve(session->partial_results, &session->partial_results_size,
+                                       (size_t)session->nr_dpus * result_bytes);
+    if (!session->partial_sums || !session->partial_results) {
+        return KMEANS_NO_MEMORY;
+    }
+    sums = session->partial_sums;
+    DPU_FOREACH(session->dpus, dpu, i) {
+        DPU_CHECK(dpu_prepare_xfer(dpu, &sums[(size_t)i * sums_len]));
+    }
+    DPU_CHECK(dpu_push_xfer(session->dpus, DPU_XFER_FROM_DPU, "partial_sums", 0, sums_len * sizeof(float), DPU_XFER_DEFAULT));
+    DPU_FOREACH(session->dpus, dpu, i) {
+        DPU_CHECK(dpu_prepare_xfer(dpu, &session->partial_results[(size_t)i * result_bytes]));
+    }
+    DPU_CHECK(dpu_push_xfer(session->dpus, DPU_XFER_FROM_DPU, "step_result", 0, result_bytes, DPU_XFER_DEFAULT));
+
+    new_centroids = calloc((size_t)layout->nr_groups * k * dims, sizeof(double));
+    count = calloc((size_t)layout->nr_groups * k, sizeof(uint64_t));
+    status = new_centroids && count ? KMEANS_OK : KMEANS_NO_MEMORY;
+    if (status == KMEANS_OK) {
+        status = reduce_partials(session, sums, sums_len, result_bytes, k, dims, job->compensated, new_centroids, count);
+    }
+    if (status == KMEANS_OK) {
+        status = relocate_empty_clusters(session, k, dims, new_centroids, count, &job->relocated);
+    }
+    if (status != KMEANS_OK) {
+        free(new_centroids);
+        free(count);
+        return status;
+    }
+    for (uint32_t group = 0; group < layout->nr_groups; group++) {
+        inertia[group] = 0.0;
+    }
+    for (i = 0; i < layout->nr_groups * layout->group_size; i++) {
+        uint32_t group = i / layout->group_size;
+        dpu_step_result_t *result = (dpu_step_result_t *)&session->partial_results[(size_t)i * result_bytes];
+        inertia[group] += result->header.inertia;
+        job->full_searches += result->header.full_searches;
+        cycles = result->header.cycles > cycles ? result->header.cycles : cycles;
+        for (uint32_t phase = 0; phase < NR_DPU_PHASES; phase++) {
+            if (result->header.phase_cycles[phase] > phase_cycles[phase]) {
+                phase_cycles[phase] = result->header.phase_cycles[phase];
+            }
+        }
+    }
+    job->dpu_cycles += cycles;
+    for (uint32_t phase = 0; phase < NR_DPU_PHASES; phase++) {
+        job->dpu_phase_cycles[phase] += phase_cycles[phase];
+    }
+
+    for (uint32_t group = 0; group < layout->nr_groups; group++) {
+        for (uint32_t j = 0; j < k; j++) {
+            if (count[group * k + j] != 0) {
+                for (uint32_t d = 0; d < dims; d++) {
+                    centroids[group * stride + j * dims + d] =
+                        new_centroids[((size_t)group * k + j) * dims + d] / count[group * k + j];
+                }
+            }
+        }
+    }
+
+    free(new_centroids);
+    free(count);
+    return KMEANS_OK;
+}
+
+// One assignment pass of every group from its centroids, stride floats apart,
+// which then move to the means of their points
+static int step(kmeans_session_t *session, kmeans_job_t *job, float *centroids, uint32_t stride, double *inertia) {
+    int status = push_centroids(session, centroids, stride);
+
+    if (status != KMEANS_OK) {
+        return status;
+    }
+    DPU_CHECK(dpu_launch(session->dpus, DPU_SYNCHRONOUS));
+    return update_centroids(session, job, centroids, stride, inertia);
+}
+
+// Gather the packed labels of every shard into session->labels in one transfer
+static int gather_clusters(kmeans_session_t *session, uint32_t nr_padded, uint32_t width) {
+    struct dpu_set_t dpu;
+    uint32_t i;
+    size_t shard_bytes = (size_t)nr_padded * width;
+
+    session->labels = reserve(session->labels, &session->labels_size, session->nr_dpus * shard_bytes);
+    if (!session->labels) {
+        return KMEANS_NO_MEMORY;
+    }
+    DPU_FOREACH(session->dpus, dpu, i) {
+        DPU_CHECK(dpu_prepare_xfer(dpu, &session->labels[i * shard_bytes]));
+    }
+    DPU_CHECK(dpu_push_xfer(session->dpus, DPU_XFER_FROM_DPU, "clusters", 0, shard_bytes, DPU_XFER_DEFAULT));
+    return KMEANS_OK;
+}
+
+// Widen n packed labels of the given width into ints
+static void unpack_labels(int *out, const uint8_t *in, uint32_t n, uint32_t width) {
+    if (width == 1) {
+        for (uint32_t i = 0; i < n; i++) {
+            out[i] = in[i];
+        }
+    } else {
+        const uint16_t *in16 = (const uint16_t *)in;
+        for (uint32_t i = 0; i < n; i++) {
+            out[i] = in16[i];
+        }
+    }
+}
+
+// Copy the gathered labels of one group into job->labels, back in the job's
+// point order if the shards were spatially sorted or stratified
+static int copy_group_labels(kmeans_session_t *session, kmeans_job_t *job, uint32_t group) {
+    shard_layout_t *layout = &session->layout;
+    uint32_t width = label_bytes(job->k);
+    int permuted = job->spatial_order || job->nr_stages;
+    int *labels = permuted ? malloc(job->nr_points * sizeof(int)) : job->labels;
+
+    if (!labels) {
+        return KMEANS_NO_MEMORY;
+    }
+    for (uint32_t i = group * layout->group_size; i < (group + 1) * layout->group_size; i++) {
+        unpack_labels(&labels[layout->offsets[i]], &session->labels[(size_t)i * layout->nr_padded * width],
+                      layout->sizes[i], width);
+    }
+    if (permuted) {
+        for (uint32_t p = 0; p < job->nr_points; p++) {
+            job->labels[session->order[p]] = labels[p];
+        }
+        free(labels);
+    }
+    return KMEANS_OK;
+}
+
+// Accuracy of a POINTS_UINT16 job: compare its centroids with the fp32 means
+// of the original points under the same final assignment (that of group)
+static int centroid_error(kmeans_session_t *session, const kmeans_job_t *job, uint32_t group, double *error) {
+    shard_layout_t *layout = &session->layout;
+    uint32_t k = job->k, dims = job->dims, width = label_bytes(k);
+    double *sums = calloc((size_t)k * dims, sizeof(double));
+    uint64_t *counts = calloc(k, sizeof(uint64_t));
+    int *labels = malloc(layout->nr_padded * sizeof(int));
+
+    *error = 0.0;
+    if (!sums || !counts || !labels) {
+        free(sums);
+        free(counts);
+        free(labels);
+        return KMEANS_NO_MEMORY;
+    }
+    for (uint32_t i = group * layout->group_size; i < (group + 1) * layout->group_size; i++) {
+        unpack_labels(labels, &session->labels[(size_t)i * layout->nr_padded * width], layout->sizes[i], width);
+        for (uint32_t p = 0; p < layout->sizes[i]; p++) {
+            const float *point = &job->points[((size_t)layout->offsets[i] + p) * dims];
+            for (uint32_t d = 0; d < dims; d++) {
+                sums[labels[p] * dims + d] += point[d];
+            }
+            counts[labels[p]]++;
+        }
+    }
+    for (uint32_t j = 0; j < k; j++) {
+        for (uint32_t d = 0; d < dims && counts[j] != 0; d++) {
+            double diff = fabs(sums[j * dims + d] / counts[j] - job->centroids[j * dims + d]);
+            *error = diff > *error ? diff : *error;
+        }
+    }
+
+    free(sums);
+    free(counts);
+    free(labels);
+    return KMEANS_OK;
+}
+
+// Initialize centroids with random points
+static void init_centroids(const kmeans_job_t *job, unsigned int seed, float *centroids) {
+    // Counter-based like generate_point(): no global rand() state for
+    // concurrent sessions (e.g. Python threads without the GIL) to race on
+    uint32_t stream = hash32(seed);
+
+    for (uint32_t j = 0; j < job->k; j++) {
+        uint32_t index = hash32(stream + j * 0x9e3779b9u) % job->nr_points;
+        if (job->generator) {
+            generate_point(job->generator, index, job->dims, &centroids[j * job->dims]);
+        } else {
+            memcpy(&centroids[j * job->dims], &job->points[(size_t)index * job->dims], job->dims * sizeof(float));
+        }
+    }
+}
+
+// Everything but kd-tree jobs needs DPUs, see kmeans_session_open_host()
+static int check_dpus(const kmeans_session_t *session) {
+    if (!session->has_dpus) {
+        printf("Error: the session has no DPUs, only kd-tree jobs run on it\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int check_job(const kmeans_job_t *job) {
+    if (job->dims == 0 || job->dims > MAX_DIMENSIONS || job->k == 0 || job->k > MAX_K || job->k > job->nr_points ||
+        job->k * job->dims > MAX_CENTROID_FLOATS || job->max_iterations == 0 || job->format > POINTS_UINT16 ||
+        job->backend > BACKEND_AUTO || job->coarse_k > job->k) {
+        printf("Error: job with %u points, D=%u, K=%u, %u iterations is not supported (max D=%u, K=%u, KxD=%u)\n",
+               job->nr_points, job->dims, job->k, job->max_iterations, MAX_DIMENSIONS, MAX_K, MAX_CENTROID_FLOATS);
+        return -1;
+    }
+    return 0;
+}
+
+static int check_generator(const kmeans_job_t *job) {
+    if (job->generator && (job->generator->nr_clusters == 0 || job->format != POINTS_FP32 || job->spatial_order ||
+                           job->nr_stages || job->incremental || job->coarse_k > 1 || job->backend != BACKEND_DPU)) {
+        printf("Error: generated jobs need clusters and run on the DPUs in fp32, without spatial order, schedule, "
+               "incremental mode nor coarse level\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int check_schedule(const kmeans_job_t *job) {
+    if (job->nr_stages && (!job->schedule || job->spatial_order || job->incremental)) {
+        printf("Error: a subsample schedule needs stages and no spatial order nor incremental mode\n");
+        return -1;
+    }
+    for (uint32_t stage = 0; stage < job->nr_stages; stage++) {
+        if (!(job->schedule[stage].fraction > 0.0f && job->schedule[stage].fraction <= 1.0f)) {
+            printf("Error: stage %u samples a fraction %g of the points, not in (0, 1]\n", stage,
+                   job->schedule[stage].fraction);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Run one wave of at most nr_dpus independent problems in a single launch:
+// job i is the whole shard of DPU i and is iterated on the DPU
+typedef struct {
+    kmeans_job_t **jobs;
+    uint32_t nr_jobs;
+    uint32_t shard_floats;
+} batch_copy_t;
+
+static void copy_problem(kmeans_session_t *session, const void *context, uint32_t i) {
+    const batch_copy_t *copy = context;
+    float *shard = (float *)staged_shard(session, i, (size_t)copy->shard_floats * sizeof(float));
+    size_t count = i < copy->nr_jobs ? (size_t)copy->jobs[i]->nr_points * copy->jobs[i]->dims : 0;
+
+    if (count) {
+        memcpy(shard, copy->jobs[i]->points, count * sizeof(float));
+    }
+    memset(shard + count, 0, (copy->shard_floats - count) * sizeof(float));
+}
+
+// Push the problems, initial centroids and arguments of a wave, run it, and
+// read the iterations and centroids of every problem back in one transfer
+static int launch_batch_wave(kmeans_session_t *session, uint32_t shard_floats, float *initial,
+                             uint32_t centroid_floats, dpu_arguments_t *args, uint8_t *results, uint32_t result_bytes) {
+    struct dpu_set_t dpu;
+    uint32_t i;
+
+    session->model_k = 0;
+    session->resident = NULL;
+    DPU_FOREACH(session->dpus, dpu, i) {
+        DPU_CHECK(dpu_prepare_xfer(dpu, staged_shard(session, i, (size_t)shard_floats * sizeof(float))));
+    }
+    DPU_CHECK(dpu_push_xfer(session->dpus, DPU_XFER_TO_DPU, "points", 0, shard_floats * sizeof(float), DPU_XFER_DEFAULT));
+    DPU_FOREACH(session->dpus, dpu, i) {
+        DPU_CHECK(dpu_prepare_xfer(dpu, &initial[(size_t)i * centroid_floats]));
+    }
+    DPU_CHECK(dpu_push_xfer(session->dpus, DPU_XFER_TO_DPU, "centroids", 0, centroid_floats * sizeof(float),
+                            DPU_XFER_DEFAULT));
+    DPU_FOREACH(session->dpus, dpu, i) {
+        DPU_CHECK(dpu_prepare_xfer(dpu, &args[i]));
+    }
+    DPU_CHECK(dpu_push_xfer(session->dpus, DPU_XFER_TO_DPU, "DPU_INPUT_ARGUMENTS", 0, sizeof(dpu_arguments_t), DPU_XFER_DEFAULT));
+
+    DPU_CHECK(dpu_launch(session->dpus, DPU_SYNCHRONOUS));
+
+    DPU_FOREACH(session->dpus, dpu, i) {
+        DPU_CHECK(dpu_prepare_xfer(dpu, &results[(size_t)i * result_bytes]));
+    }
+    DPU_CHECK(dpu_push_xfer(session->dpus, DPU_XFER_FROM_DPU, "batch_result", 0, result_bytes, DPU_XFER_DEFAULT));
+    return KMEANS_OK;
+}
+
+static int run_batch_wave(kmeans_session_t *session, kmeans_job_t **jobs, uint32_t nr_jobs) {
+    uint32_t i;
+    uint32_t nr_padded = SHARD_ALIGN, shard_floats = 0, result_bytes = 0, dims = jobs[0]->dims;
+    uint32_t width = 0;  // Widest label among the problems that want labels back
+    dpu_arguments_t *args = calloc(session->nr_dpus, sizeof(dpu_arguments_t));
+    uint32_t centroid_floats;  // Per-DPU stride of the initial centroids
+    float *initial;
+    uint8_t *results;
+    int status;
+
+    for (i = 0; i < nr_jobs; i++) {
+        uint32_t padded = ALIGN_UP(jobs[i]->nr_points, SHARD_ALIGN);
+        if (padded > nr_padded) {
+            nr_padded = padded;
+        }
+        if (padded * jobs[i]->dims > shard_floats) {
+            shard_floats = padded * jobs[i]->dims;
+        }
+        if (jobs[i]->k * jobs[i]->dims * sizeof(float) > result_bytes) {
+            result_bytes = jobs[i]->k * jobs[i]->dims * sizeof(float);
+        }
+        if (jobs[i]->labels && label_bytes(jobs[i]->k) > width) {
+            width = label_bytes(jobs[i]->k);
+        }
+    }
+    centroid_floats = ALIGN8(result_bytes) / sizeof(float);
+    result_bytes = ALIGN8(offsetof(dpu_batch_result_t, centroids) + result_bytes);
+    initial = calloc((size_t)session->nr_dpus * centroid_floats, sizeof(float));
+    results = malloc((size_t)session->nr_dpus * result_bytes);
+
+    status = args && initial && results ? reserve_staging(session, (size_t)shard_floats * sizeof(float))
+                                        : KMEANS_NO_MEMORY;
+    if (status != KMEANS_OK) {
+        free(args);
+        free(initial);
+        free(results);
+        return status;
+    }
+    batch_copy_t copy = {jobs, nr_jobs, shard_floats};
+    fill_staging(session, copy_problem, &copy);
+    for (i = 0; i < session->nr_dpus; i++) {
+        // DPUs without a problem in this wave run with no points
+        args[i].dims = dims;
+        args[i].mode = MODE_BATCH;
+        args[i].block_bytes = session->block_bytes;
+        if (i < nr_jobs) {
+            kmeans_job_t *job = jobs[i];
+            init_centroids(job, job->seed, &initial[(size_t)i * centroid_floats]);
+            args[i].nr_points = job->nr_points;
+            args[i].nr_padded = nr_padded;
+            args[i].dims = job->dims;
+            args[i].k = job->k;
+            args[i].max_iterations = job->max_iterations;
+        }
+    }
+
+    status = launch_batch_wave(session, shard_floats, initial, centroid_floats, args, results, result_bytes);
+    for (i = 0; i < nr_jobs && status == KMEANS_OK; i++) {
+        dpu_batch_result_t *result = (dpu_batch_result_t *)&results[(size_t)i * result_bytes];
+        jobs[i]->iterations = result->header.iterations;
+        jobs[i]->inertia = result->header.inertia;
+        jobs[i]->bytes_scanned = (uint64_t)result->header.iterations * ALIGN_UP(jobs[i]->nr_points, SHARD_ALIGN) *
+                                 jobs[i]->dims * sizeof(float);
+        jobs[i]->full_searches = (uint64_t)result->header.iterations * jobs[i]->nr_points;
+        memcpy(jobs[i]->centroids, result->centroids, jobs[i]->k * jobs[i]->dims * sizeof(float));
+    }
+
+    if (width > 0 && status == KMEANS_OK && (status = gather_clusters(session, nr_padded, width)) == KMEANS_OK) {
+        for (i = 0; i < nr_jobs; i++) {
+            if (jobs[i]->labels) {
+                unpack_labels(jobs[i]->labels, &session->labels[(size_t)i * nr_padded * width],
+                              jobs[i]->nr_points, label_bytes(jobs[i]->k));
+            }
+        }
+    }
+
+    free(args);
+    free(initial);
+    free(results);
+    return status;
+}
+
+static int open_session(kmeans_session_t *session, uint32_t nr_dpus, const char *profile, const char *binary,
+                        const char *cache, uint32_t nr_points, uint32_t dims, uint32_t k) {
+    kmeans_tuning_t tuning;
+    char variant[TUNE_PATH_BYTES];
+    int status;
+
+    memset(session, 0, sizeof(*session));
+
+    DPU_CHECK(dpu_alloc(nr_dpus, profile, &session->dpus));
+    session->has_dpus = 1;
+    if ((status = count_dpus(session->dpus, &session->nr_dpus)) != KMEANS_OK ||
+        (status = init_ranks(session)) != KMEANS_OK) {
+        kmeans_session_close(session);
+        return status;
+    }
+    // The tuned variant is only taken if it was built
+    if (cache && kmeans_tuning_lookup(cache, (nr_points + session->nr_dpus - 1) / session->nr_dpus, dims, k,
+                                      &tuning) == 0 &&
+        kmeans_tuning_binary(binary, tuning.nr_tasklets, variant, sizeof(variant)) == 0) {
+        binary = variant;
+        session->block_bytes = tuning.block_bytes;
+        session->nr_tasklets = tuning.nr_tasklets;
+    }
+    if (dpu_load(session->dpus, binary, NULL) != DPU_OK) {
+        printf("Error: cannot load %s on the DPUs\n", binary);
+        kmeans_session_close(session);
+        return KMEANS_DPU_ERROR;
+    }
+
+    session->layout.nr_dpus = session->nr_dpus;
+    session->layout.offsets = malloc(session->nr_dpus * sizeof(uint32_t));
+    session->layout.sizes = malloc(session->nr_dpus * sizeof(uint32_t));
+    session->args = malloc(session->nr_dpus * sizeof(dpu_arguments_t));
+    if (!session->layout.offsets || !session->layout.sizes || !session->args) {
+        printf("Error: cannot allocate host buffers for %u DPUs\n", session->nr_dpus);
+        kmeans_session_close(session);
+        return KMEANS_NO_MEMORY;
+    }
+
+    return KMEANS_OK;
+}
+
+int kmeans_session_open(kmeans_session_t *session, uint32_t nr_dpus, const char *binary) {
+    return open_session(session, nr_dpus, NULL, binary, NULL, 0, 0, 0);
+}
+
+int kmeans_session_open_tuned(kmeans_session_t *session, uint32_t nr_dpus, const char *binary, const char *cache,
+                              uint32_t nr_points, uint32_t dims, uint32_t k) {
+    return open_session(session, nr_dpus, NULL, binary, cache, nr_points, dims, k);
+}
+
+int kmeans_session_open_profile(kmeans_session_t *session, uint32_t nr_dpus, const char *profile, const char *binary) {
+    return open_session(session, nr_dpus, profile, binary, NULL, 0, 0, 0);
+}
+
+void kmeans_session_open_host(kmeans_session_t *session) {
+    memset(session, 0, sizeof(*session));
+}
+
+void kmeans_session_close(kmeans_session_t *session) {
+    if (session->has_dpus && dpu_free(session->dpus) != DPU_OK) {
+        printf("Error: cannot free the DPUs\n");
+    }
+    free(session->layout.offsets);
+    free(session->layout.sizes);
+    for (uint32_t r = 0; r < session->nr_ranks && session->ranks; r++) {
+        hostmem_free(session->ranks[r].staging, session->ranks[r].staging_size);
+    }
+    hostmem_pool_free(session->pool);
+    free(session->ranks);
+    free(session->dpu_rank);
+    free(session->order);
+    free(session->sorted);
+    free(session->bounds);
+    free(session->partial_sums);
+    free(session->partial_results);
+    free(session->reduce_buffer);
+    free(session->far_buffer);
+    free(session->labels);
+    free(session->args);
+    free(session->slots);
+    free(session->bounded_centroids);
+    memset(session, 0, sizeof(*session));
+}
+
+// Host backend: the kd-tree is built once per job and serves every iteration
+// of every restart. format, spatial_order and schedule only concern the DPU path.
+static int run_kdtree(kmeans_job_t *job) {
+    uint32_t n_init = job->n_init ? job->n_init : 1;
+    size_t centroids_bytes = (size_t)job->k * job->dims * sizeof(float);
+    kd_tree_t tree;
+    double inertia = 0.0;
+
+    if (kd_tree_build(&tree, job->points, job->nr_points, job->dims) != 0) {
+        return KMEANS_NO_MEMORY;
+    }
+    float *centroids = malloc(centroids_bytes);
+    double *history = malloc(job->max_iterations * sizeof(double));
+    int *labels = job->labels && n_init > 1 ? malloc(job->nr_points * sizeof(int)) : job->labels;
+    int status = centroids && history && (labels || !job->labels) ? KMEANS_OK : KMEANS_NO_MEMORY;
+    for (uint32_t restart = 0; restart < n_init && status == KMEANS_OK; restart++) {
+        init_centroids(job, job->seed + restart, centroids);
+        for (job->iterations = 0; job->iterations < job->max_iterations; job->iterations++) {
+            int last = job->iterations + 1 == job->max_iterations;
+            inertia = kd_tree_iterate(&tree, centroids, job->k, last ? labels : NULL);
+            if (inertia < 0.0) {
+                status = KMEANS_NO_MEMORY;
+                break;
+            }
+            history[job->iterations] = inertia;
+        }
+        if (status != KMEANS_OK) {
+            break;
+        }
+
+        // Keep the restart with the lowest inertia
+        if (restart == 0 || inertia < job->inertia) {
+            job->inertia = inertia;
+            job->best_seed = job->seed + restart;
+            memcpy(job->centroids, centroids, centroids_bytes);
+            if (job->history) {
+                memcpy(job->history, history, job->max_iterations * sizeof(double));
+            }
+            if (labels != job->labels) {
+                memcpy(job->labels, labels, job->nr_points * sizeof(int));
+            }
+        }
+    }
+    job->centroid_error = 0.0;
+
+    kd_tree_free(&tree);
+    free(centroids);
+    free(history);
+    if (labels != job->labels) {
+        free(labels);
+    }
+    return status;
+}
+
+// Share k centroids among clusters in proportion to their sizes (largest
+// remainder), at least one per non-empty cluster and at most one per point
+static void split_k(uint32_t k, const uint32_t *sizes, uint32_t nr_clusters, uint32_t nr_points, uint32_t *shares) {
+    uint32_t assigned = 0;
+
+    for (uint32_t c = 0; c < nr_clusters; c++) {
+        shares[c] = (uint32_t)((uint64_t)k * sizes[c] / nr_points);
+        shares[c] = sizes[c] && shares[c] == 0 ? 1 : shares[c];
+        assigned += shares[c];
+    }
+    while (assigned != k) {
+        int grow = assigned < k;
+        uint32_t pick = nr_clusters;
+        double pick_gap = 0.0;
+        for (uint32_t c = 0; c < nr_clusters; c++) {
+            double gap = (double)k * sizes[c] / nr_points - shares[c];
+            if ((grow && shares[c] < sizes[c]) || (!grow && shares[c] > 1)) {
+                if (pick == nr_clusters || (grow ? gap > pick_gap : gap < pick_gap)) {
+                    pick = c;
+                    pick_gap = gap;
+                }
+            }
+        }
+        shares[pick] += grow ? 1 : -1;
+        assigned += grow ? 1 : -1;
+    }
+}
+
+// Hierarchical mode: coarse k-means, then one sub-problem per coarse cluster.
+// Sub-problems no larger than a DPU's share of the job (and that fit its
+// MRAM) go through batch mode, one per DPU; larger ones through the regular
+// multi-DPU path, which spreads them on all DPUs. The cost counters of the
+// job add up those of the coarse job and of the multi-DPU leaves.
+static int run_hierarchical(kmeans_session_t *session, kmeans_job_t *job) {
+    uint32_t nr_clusters = job->coarse_k, dims = job->dims;
+    kmeans_job_t coarse = *job;
+    int *coarse_labels = malloc(job->nr_points * sizeof(int));
+    int status;
+
+    coarse.k = nr_clusters;
+    coarse.coarse_k = 0;
+    coarse.centroids = malloc((size_t)nr_clusters * dims * sizeof(float));
+    coarse.labels = coarse_labels;
+    status = coarse_labels && coarse.centroids ? kmeans_session_run(session, &coarse) : KMEANS_NO_MEMORY;
+    if (status != KMEANS_OK) {
+        free(coarse.centroids);
+        free(coarse_labels);
+        return status;
+    }
+    job->iterations = coarse.iterations;
+    job->best_seed = coarse.best_seed;
+    job->centroid_error = coarse.centroid_error;
+
+    kmeans_job_t *leaves = calloc(nr_clusters, sizeof(kmeans_job_t));
+    kmeans_job_t **batch = malloc(nr_clusters * sizeof(kmeans_job_t *));
+    uint32_t *sizes = calloc(nr_clusters, sizeof(uint32_t));
+    uint32_t *shares = malloc(nr_clusters * sizeof(uint32_t));
+    uint32_t *first = malloc(nr_clusters * sizeof(uint32_t));
+    uint32_t *order = malloc(job->nr_points * sizeof(uint32_t));
+    int *leaf_labels = malloc(job->nr_points * sizeof(int));
+    float *grouped = malloc((size_t)job->nr_points * dims * sizeof(float));
+    uint32_t nr_batch = 0, centroid = 0;
+    uint32_t batch_points = job->nr_points / session->nr_dpus;
+
+    if (!leaves || !batch || !sizes || !shares || !first || !order || !leaf_labels || !grouped) {
+        printf("Error: cannot allocate the leaves of %u coarse clusters\n", nr_clusters);
+        status = KMEANS_NO_MEMORY;
+    } else {
+        // Group the points by coarse cluster
+        for (uint32_t i = 0; i < job->nr_points; i++) {
+            sizes[coarse_labels[i]]++;
+        }
+        for (uint32_t c = 0, offset = 0; c < nr_clusters; c++) {
+            first[c] = offset;
+            offset += sizes[c];
+        }
+        for (uint32_t i = 0; i < job->nr_points; i++) {
+            uint32_t slot = first[coarse_labels[i]]++;
+            order[slot] = i;
+            memcpy(&grouped[(size_t)slot * dims], &job->points[(size_t)i * dims], dims * sizeof(float));
+        }
+        split_k(job->k, sizes, nr_clusters, job->nr_points, shares);
+    }
+
+    for (uint32_t c = 0, offset = 0; c < nr_clusters && status == KMEANS_OK; c++) {
+        kmeans_job_t *leaf = &leaves[c];
+        first[c] = offset;
+        offset += sizes[c];
+        if (sizes[c] == 0) {
+            continue;
+        }
+        leaf->points = &grouped[(size_t)first[c] * dims];
+        leaf->nr_points = sizes[c];
+        leaf->dims = dims;
+        leaf->k = shares[c];
+        leaf->max_iterations = job->max_iterations;
+        leaf->seed = job->seed + 1 + c;
+        leaf->centroids = &job->centroids[(size_t)centroid * dims];
+        leaf->labels = &leaf_labels[first[c]];
+        centroid += shares[c];
+        if (sizes[c] <= batch_points && ALIGN_UP(sizes[c], SHARD_ALIGN) <= MAX_POINTS_PER_DPU &&
+            (uint64_t)ALIGN_UP(sizes[c], SHARD_ALIGN) * dims <= MAX_POINT_FLOATS) {
+            batch[nr_batch++] = leaf;
+        } else {
+            status = kmeans_session_run(session, leaf);
+        }
+    }
+    for (uint32_t i = 0; i < nr_batch && status == KMEANS_OK; i += session->nr_dpus) {
+        uint32_t wave = nr_batch - i < session->nr_dpus ? nr_batch - i : session->nr_dpus;
+        status = run_batch_wave(session, &batch[i], wave);
+    }
+
+    // Leaf labels are offset by the first centroid of their leaf
+    job->inertia = 0.0;
+    job->bytes_scanned = coarse.bytes_scanned;
+    job->full_searches = coarse.full_searches;
+    job->relocated = coarse.relocated;
+    job->dpu_cycles = coarse.dpu_cycles;
+    memcpy(job->dpu_phase_cycles, coarse.dpu_phase_cycles, sizeof(job->dpu_phase_cycles));
+    for (uint32_t c = 0, base = 0; c < nr_clusters && status == KMEANS_OK; c++) {
+        if (sizes[c] == 0) {
+            continue;
+        }
+        job->inertia += leaves[c].inertia;
+        job->bytes_scanned += leaves[c].bytes_scanned;
+        job->full_searches += leaves[c].full_searches;
+        job->relocated += leaves[c].relocated;
+        job->dpu_cycles += leaves[c].dpu_cycles;
+        for (uint32_t phase = 0; phase < NR_DPU_PHASES; phase++) {
+            job->dpu_phase_cycles[phase] += leaves[c].dpu_phase_cycles[phase];
+        }
+        if (job->labels) {
+            for (uint32_t p = first[c]; p < first[c] + sizes[c]; p++) {
+                job->labels[order[p]] = base + leaf_labels[p];
+            }
+        }
+        base += shares[c];
+    }
+
+    free(coarse.centroids);
+    free(leaves);
+    free(batch);
+    free(sizes);
+    free(shares);
+    free(first);
+    free(order);
+    free(coarse_labels);
+    free(leaf_labels);
+    free(grouped);
+    return status;
+}
+
+// Incremental jobs: tell the DPUs how far each centroid about to be pushed
+// moved from the one the bounds were computed against
+static int push_drift(kmeans_session_t *session, const kmeans_job_t *job, const float *centroids) {
+    dpu_drift_t drift = {0.0f, 0.0f, 0, 0};
+    double max = 0.0, second = 0.0;
+
+    for (uint32_t j = 0; j < job->k; j++) {
+        double moved = 0.0;
+        for (uint32_t d = 0; d < job->dims; d++) {
+            double diff = (double)centroids[j * job->dims + d] - session->bounded_centroids[j * job->dims + d];
+            moved += diff * diff;
+        }
+        moved = sqrt(moved);
+        if (moved > max) {
+            second = max;
+            max = moved;
+            drift.argmax = j;
+        } else if (moved > second) {
+            second = moved;
+        }
+    }
+    // Rounded up, so that a lowered bound never exceeds the true distance
+    drift.max = (float)(max * (1.0 + 1e-6));
+    drift.second = (float)(second * (1.0 + 1e-6));
+    DPU_CHECK(dpu_broadcast_to(session->dpus, "bound_drift", 0, &drift, sizeof(drift), DPU_XFER_DEFAULT));
+    return KMEANS_OK;
+}
+
+// Make room for nr_padded slots per DPU in the slot map, keeping the slots in use
+static int grow_slots(kmeans_session_t *session, uint32_t nr_padded) {
+    uint32_t *slots;
+
+    if (nr_padded <= session->slots_stride) {
+        return KMEANS_OK;
+    }
+    slots = malloc((size_t)session->nr_dpus * nr_padded * sizeof(uint32_t));
+    if (!slots) {
+        printf("Error: cannot allocate the slot map of %u points per DPU\n", nr_padded);
+        return KMEANS_NO_MEMORY;
+    }
+    if (session->slots) {
+        for (uint32_t i = 0; i < session->nr_dpus; i++) {
+            memcpy(&slots[(size_t)i * nr_padded], &session->slots[(size_t)i * session->slots_stride],
+                   session->layout.sizes[i] * sizeof(uint32_t));
+        }
+    }
+    free(session->slots);
+    session->slots = slots;
+    session->slots_stride = nr_padded;
+    return KMEANS_OK;
+}
+
+// Iterate a resident incremental job from job->centroids until its centroids
+// stop moving or max_iterations, then read its labels back through the slot map
+static int iterate_resident(kmeans_session_t *session, kmeans_job_t *job) {
+    shard_layout_t *layout = &session->layout;
+    uint32_t k = job->k, dims = job->dims, width = label_bytes(k);
+    uint32_t stride = ALIGN8(k * dims * sizeof(float)) / sizeof(float);
+    float *centroids = calloc(stride, sizeof(float));
+    double inertia = 0.0;
+    int status;
+
+    if (!centroids) {
+        return KMEANS_NO_MEMORY;
+    }
+    memcpy(centroids, job->centroids, (size_t)k * dims * sizeof(float));
+    job->full_searches = 0;
+    job->relocated = 0;
+    job->bytes_scanned = 0;
+    job->dpu_cycles = 0;
+    memset(job->dpu_phase_cycles, 0, sizeof(job->dpu_phase_cycles));
+    status = push_args(session);
+    for (job->iterations = 0; job->iterations < job->max_iterations && status == KMEANS_OK;) {
+        // After the first pass every point has a bound
+        if (job->iterations == 1) {
+            for (uint32_t i = 0; i < session->nr_dpus; i++) {
+                session->args[i].bounded_points = session->args[i].nr_points;
+            }
+            if ((status = push_args(session)) != KMEANS_OK) {
+                break;
+            }
+        }
+        if ((status = push_drift(session, job, centroids)) != KMEANS_OK) {
+            break;
+        }
+        memcpy(session->bounded_centroids, centroids, stride * sizeof(float));
+        if ((status = step(session, job, centroids, stride, &inertia)) != KMEANS_OK) {
+            break;
+        }
+        job->bytes_scanned += pass_bytes(session);
+        if (job->history) {
+            job->history[job->iterations] = inertia;
+        }
+        job->iterations++;
+        if (memcmp(centroids, session->bounded_centroids, stride * sizeof(float)) == 0) {
+            break;
+        }
+    }
+    if (status != KMEANS_OK) {
+        free(centroids);
+        return status;
+    }
+    job->inertia = inertia;
+    memcpy(job->centroids, centroids, (size_t)k * dims * sizeof(float));
+    free(centroids);
+
+    if (job->labels) {
+        if ((status = gather_clusters(session, layout->nr_padded, width)) != KMEANS_OK) {
+            return status;
+        }
+        for (uint32_t i = 0; i < session->nr_dpus; i++) {
+            const uint8_t *shard = &session->labels[(size_t)i * layout->nr_padded * width];
+            for (uint32_t slot = 0; slot < layout->sizes[i]; slot++) {
+                job->labels[session->slots[(size_t)i * session->slots_stride + slot]] =
+                    width == 1 ? shard[slot] : ((const uint16_t *)shard)[slot];
+            }
+        }
+    }
+    session->resident = job;
+    session->resident_points = job->nr_points;
+    return KMEANS_OK;
+}
+
+// First run of an incremental job: regular shards on all DPUs, with bounds
+static int run_incremental(kmeans_session_t *session, kmeans_job_t *job) {
+    shard_layout_t *layout = &session->layout;
+    uint32_t stride = ALIGN8(job->k * job->dims * sizeof(float)) / sizeof(float);
+    int status;
+
+    if ((job->n_init && job->n_init != 1) || job->format != POINTS_FP32 || job->spatial_order ||
+        job->backend != BACKEND_DPU || job->coarse_k > 1) {
+        printf("Error: incremental jobs run on the DPUs with fp32 points, without restarts, spatial order nor coarse level\n");
+        return KMEANS_REJECTED;
+    }
+    if (plan_shards(layout, job->nr_points, job->dims, 1) != 0) {
+        return KMEANS_REJECTED;
+    }
+    if ((status = transfer_shards(session, job)) != KMEANS_OK ||
+        (status = grow_slots(session, layout->nr_padded)) != KMEANS_OK) {
+        return status;
+    }
+    for (uint32_t i = 0; i < session->nr_dpus; i++) {
+        for (uint32_t slot = 0; slot < layout->sizes[i]; slot++) {
+            session->slots[(size_t)i * session->slots_stride + slot] = layout->offsets[i] + slot;
+        }
+    }
+    session->bounded_centroids = reserve(session->bounded_centroids, &session->bounded_centroids_size,
+                                         stride * sizeof(float));
+    if (!session->bounded_centroids) {
+        return KMEANS_NO_MEMORY;
+    }
+    memset(session->bounded_centroids, 0, stride * sizeof(float));
+
+    init_centroids(job, job->seed, job->centroids);
+    job->best_seed = job->seed;
+    job->centroid_error = 0.0;
+    return iterate_resident(session, job);
+}
+
+// Push slots [first[i], sizes[i]) of every DPU from its staged shard of
+// shard_floats; DPUs starting at the same slot share a transfer
+static int push_appended(kmeans_session_t *session, const uint32_t *first, const uint32_t *sizes, uint8_t *sent,
+                         size_t shard_floats, uint32_t dims) {
+    struct dpu_set_t dpu;
+    uint32_t nr_dpus = session->nr_dpus;
+
+    for (uint32_t i = 0; i < nr_dpus; i++) {
+        sent[i] = sizes[i] == first[i];
+    }
+    for (uint32_t group = 0; group < nr_dpus; group++) {
+        uint32_t start = first[group], length = 0, j;
+        if (sent[group]) {
+            continue;
+        }
+        for (j = group; j < nr_dpus; j++) {
+            if (!sent[j] && first[j] == start && ALIGN_UP(sizes[j] - start, SHARD_ALIGN) > length) {
+                length = ALIGN_UP(sizes[j] - start, SHARD_ALIGN);
+            }
+        }
+        // DPUs without a prepared buffer are left out of the transfer
+        DPU_FOREACH(session->dpus, dpu, j) {
+            if (!sent[j] && first[j] == start) {
+                DPU_CHECK(dpu_prepare_xfer(dpu, staged_shard(session, j, shard_floats * sizeof(float))));
+                sent[j] = 1;
+            }
+        }
+        DPU_CHECK(dpu_push_xfer(session->dpus, DPU_XFER_TO_DPU, "points", (size_t)start * dims * sizeof(float),
+                                (size_t)length * dims * sizeof(float), DPU_XFER_DEFAULT));
+    }
+    return KMEANS_OK;
+}
+
+int kmeans_session_append(kmeans_session_t *session, kmeans_job_t *job, uint32_t nr_resident) {
+    shard_layout_t *layout = &session->layout;
+    uint32_t i, dims = job->dims, nr_dpus = session->nr_dpus;
+    uint32_t base, extra, nr_padded;
+    uint32_t largest = 0, nr_largest = 0, nr_smaller = 0, span = 0, next = nr_resident;
+    uint32_t *first, *sizes;
+    uint8_t *sent;
+    int status;
+
+    if (session->resident != job || session->resident_points != nr_resident || job->nr_points < nr_resident ||
+        job->k != session->args[0].k || job->dims != session->args[0].dims) {
+        printf("Error: the job is not resident on this session with %u points\n", nr_resident);
+        return KMEANS_REJECTED;
+    }
+    if (check_job(job) != 0) {
+        return KMEANS_REJECTED;
+    }
+    base = job->nr_points / nr_dpus;
+    extra = job->nr_points % nr_dpus;
+    nr_padded = ALIGN_UP(base + (extra ? 1 : 0), SHARD_ALIGN);
+    if (nr_padded > MAX_POINTS_PER_DPU || (uint64_t)nr_padded * dims > MAX_POINT_FLOATS) {
+        printf("Error: %u points per DPU do not fit in MRAM\n", nr_padded);
+        return KMEANS_REJECTED;
+    }
+    nr_padded = nr_padded > layout->nr_padded ? nr_padded : layout->nr_padded;
+    first = malloc(nr_dpus * sizeof(uint32_t));
+    sizes = malloc(nr_dpus * sizeof(uint32_t));
+    sent = malloc(nr_dpus);
+    status = first && sizes && sent ? grow_slots(session, nr_padded) : KMEANS_NO_MEMORY;
+    if (status != KMEANS_OK) {
+        free(first);
+        free(sizes);
+        free(sent);
+        return status;
+    }
+    // From here on a failure leaves the DPUs without a usable copy of the job
+    session->resident = NULL;
+
+    // Shards stay balanced and none shrinks: the largest ones take the extra points first
+    for (i = 0; i < nr_dpus; i++) {
+        largest = layout->sizes[i] > largest ? layout->sizes[i] : largest;
+    }
+    for (i = 0; i < nr_dpus; i++) {
+        nr_largest += layout->sizes[i] == largest;
+    }
+    for (i = 0; i < nr_dpus; i++) {
+        uint32_t rank = layout->sizes[i] == largest ? i - nr_smaller : nr_largest + nr_smaller++;
+        sizes[i] = base + (rank < extra ? 1 : 0);
+        for (uint32_t slot = layout->sizes[i]; slot < sizes[i]; slot++) {
+            session->slots[(size_t)i * session->slots_stride + slot] = next++;
+        }
+        // Resend the resident points of a partial SHARD_ALIGN group, so the
+        // transfer starts 8-byte aligned; their bounds are recomputed
+        first[i] = sizes[i] > layout->sizes[i] ? layout->sizes[i] / SHARD_ALIGN * SHARD_ALIGN : sizes[i];
+        span = ALIGN_UP(sizes[i] - first[i], SHARD_ALIGN) > span ? ALIGN_UP(sizes[i] - first[i], SHARD_ALIGN) : span;
+    }
+
+    size_t shard_floats = (size_t)span * dims;
+    status = reserve_staging(session, shard_floats * sizeof(float));
+    for (i = 0; i < nr_dpus && status == KMEANS_OK; i++) {
+        float *shard = (float *)staged_shard(session, i, shard_floats * sizeof(float));
+        for (uint32_t slot = first[i]; slot < sizes[i]; slot++) {
+            uint32_t point = session->slots[(size_t)i * session->slots_stride + slot];
+            memcpy(&shard[(size_t)(slot - first[i]) * dims], &job->points[(size_t)point * dims], dims * sizeof(float));
+        }
+        memset(&shard[(size_t)(sizes[i] - first[i]) * dims], 0,
+               (shard_floats - (size_t)(sizes[i] - first[i]) * dims) * sizeof(float));
+    }
+    if (status == KMEANS_OK) {
+        status = push_appended(session, first, sizes, sent, shard_floats, dims);
+    }
+
+    layout->nr_padded = nr_padded;
+    for (i = 0; i < nr_dpus; i++) {
+        layout->sizes[i] = sizes[i];
+        session->args[i].nr_points = sizes[i];
+        session->args[i].nr_padded = nr_padded;
+        session->args[i].bounded_points = first[i];
+    }
+    free(first);
+    free(sizes);
+    free(sent);
+
+    return status == KMEANS_OK ? iterate_resident(session, job) : status;
+}
+
+// Restarts run nr_groups at a time, each group of DPUs with its own seed;
+// centroids, inertia and history hold the current restart of every group
+static int run_restarts(kmeans_session_t *session, kmeans_job_t *job, const kmeans_job_t *staged, uint32_t nr_groups,
+                        uint32_t stride, float *centroids, double *inertia, double *history) {
+    uint32_t n_init = job->n_init ? job->n_init : 1;
+    int status;
+
+    for (uint32_t first = 0; first < n_init; first += nr_groups) {
+        uint32_t active = n_init - first < nr_groups ? n_init - first : nr_groups;
+
+        for (uint32_t group = 0; group < nr_groups; group++) {
+            init_centroids(job, job->seed + first + (group < active ? group : 0), &centroids[group * stride]);
+        }
+        // Every restart ends on a full pass
+        float fraction = 1.0f;
+        uint32_t sampled = job->nr_points;
+        for (job->iterations = 0; job->iterations < job->max_iterations; job->iterations++) {
+            if (stage_fraction(job, job->iterations) != fraction) {
+                fraction = stage_fraction(job, job->iterations);
+                if ((status = sample_shards(session, fraction, &sampled)) != KMEANS_OK) {
+                    return status;
+                }
+            }
+            if ((status = step(session, job, centroids, stride, inertia)) != KMEANS_OK) {
+                return status;
+            }
+            job->bytes_scanned += pass_bytes(session);
+            for (uint32_t group = 0; group < nr_groups; group++) {
+                history[(size_t)group * job->max_iterations + job->iterations] =
+                    inertia[group] * job->nr_points / sampled;
+            }
+        }
+
+        // Keep the restart with the lowest inertia
+        if ((job->labels || job->format == POINTS_UINT16) &&
+            (status = gather_clusters(session, session->layout.nr_padded, label_bytes(job->k))) != KMEANS_OK) {
+            return status;
+        }
+        for (uint32_t group = 0; group < active; group++) {
+            if (first + group == 0 || inertia[group] < job->inertia) {
+                job->inertia = inertia[group];
+                job->best_seed = job->seed + first + group;
+                memcpy(job->centroids, &centroids[group * stride], job->k * job->dims * sizeof(float));
+                if (job->history) {
+                    memcpy(job->history, &history[(size_t)group * job->max_iterations],
+                           job->max_iterations * sizeof(double));
+                }
+                if (job->labels && (status = copy_group_labels(session, job, group)) != KMEANS_OK) {
+                    return status;
+                }
+                if (job->format == POINTS_UINT16 &&
+                    (status = centroid_error(session, staged, group, &job->centroid_error)) != KMEANS_OK) {
+                    return status;
+                }
+            }
+        }
+    }
+    return KMEANS_OK;
+}
+
+int kmeans_session_run(kmeans_session_t *session, kmeans_job_t *job) {
+    uint32_t n_init = job->n_init ? job->n_init : 1;
+    uint32_t nr_groups = n_init < session->nr_dpus ? n_init : session->nr_dpus;
+    uint32_t stride = ALIGN8(job->k * job->dims * sizeof(float)) / sizeof(float);
+    int on_host = job->backend == BACKEND_KDTREE ||
+                  (job->backend == BACKEND_AUTO && (job->dims <= KDTREE_AUTO_DIMENSIONS || !session->has_dpus));
+    float *centroids;
+    double *inertia, *history;
+    kmeans_job_t sorted_job;
+    const kmeans_job_t *staged = job;  // The points as sharded on the DPUs
+    int status;
+
+    if (check_job(job) != 0 || check_schedule(job) != 0 || check_generator(job) != 0) {
+        return KMEANS_REJECTED;
+    }
+    job->full_searches = 0;
+    job->relocated = 0;
+    job->bytes_scanned = 0;
+    job->dpu_cycles = 0;
+    memset(job->dpu_phase_cycles, 0, sizeof(job->dpu_phase_cycles));
+    if (on_host && !job->incremental && job->coarse_k <= 1) {
+        return run_kdtree(job);
+    }
+    if (check_dpus(session) != 0) {
+        return KMEANS_REJECTED;
+    }
+    if (job->incremental) {
+        return run_incremental(session, job);
+    }
+    if (job->coarse_k > 1) {
+        return run_hierarchical(session, job);
+    }
+    if (plan_shards(&session->layout, job->nr_points, job->dims, nr_groups) != 0) {
+        return KMEANS_REJECTED;
+    }
+    // Initial centroids are still drawn from the job's own point order
+    if (job->spatial_order || job->nr_stages) {
+        status = job->spatial_order ? sort_spatially(session, job) : stratify_shards(session, job);
+        if (status != KMEANS_OK) {
+            return status;
+        }
+        sorted_job = *job;
+        sorted_job.points = session->sorted;
+        staged = &sorted_job;
+    }
+    status = job->generator ? generate_shards(session, job) : transfer_shards(session, staged);
+    if (status != KMEANS_OK) {
+        return status;
+    }
+
+    centroids = calloc((size_t)nr_groups * stride, sizeof(float));
+    inertia = malloc(nr_groups * sizeof(double));
+    history = malloc((size_t)nr_groups * job->max_iterations * sizeof(double));
+    status = centroids && inertia && history
+                 ? run_restarts(session, job, staged, nr_groups, stride, centroids, inertia, history)
+                 : KMEANS_NO_MEMORY;
+
+    free(centroids);
+    free(inertia);
+    free(history);
+    return status;
+}
+
+int kmeans_session_run_batch(kmeans_session_t *session, kmeans_job_t *jobs, uint32_t nr_jobs) {
+    kmeans_job_t **wave;
+    uint32_t nr_wave = 0;
+    int status = KMEANS_OK, wave_status = KMEANS_OK;
+
+    if (check_dpus(session) != 0) {
+        return KMEANS_REJECTED;
+    }
+    wave = malloc(session->nr_dpus * sizeof(kmeans_job_t *));
+    if (!wave) {
+        return KMEANS_NO_MEMORY;
+    }
+    for (uint32_t i = 0; i < nr_jobs && wave_status == KMEANS_OK; i++) {
+        kmeans_job_t *job = &jobs[i];
+        job->iterations = 0;
+        if (check_job(job) != 0) {
+            status = KMEANS_REJECTED;
+            continue;
+        }
+        if (job->generator) {
+            printf("Error: batch problem %u has no host points\n", i);
+            status = KMEANS_REJECTED;
+            continue;
+        }
+        if (ALIGN_UP(job->nr_points, SHARD_ALIGN) > MAX_POINTS_PER_DPU ||
+            (uint64_t)ALIGN_UP(job->nr_points, SHARD_ALIGN) * job->dims > MAX_POINT_FLOATS) {
+            printf("Error: batch problem %u with %u points does not fit in one DPU\n", i, job->nr_points);
+            status = KMEANS_REJECTED;
+            continue;
+        }
+        wave[nr_wave++] = job;
+        if (nr_wave == session->nr_dpus) {
+            wave_status = run_batch_wave(session, wave, nr_wave);
+            nr_wave = 0;
+        }
+    }
+    if (nr_wave > 0 && wave_status == KMEANS_OK) {
+        wave_status = run_batch_wave(session, wave, nr_wave);
+    }
+
+    free(wave);
+    // A failed wave leaves the remaining problems unrun, which outweighs a rejected one
+    return wave_status != KMEANS_OK ? wave_status : status;
+}
+
+// One predict launch: its points split evenly over all DPUs, packed in its own
+// buffers so that the host can fill the next batch while the DPUs run this one
+typedef struct {
+    uint32_t first;      // First point of the batch in the caller's arrays
+    uint32_t count;
+    uint32_t nr_padded;
+    float *points;       // nr_dpus x nr_padded x dims
+    uint8_t *labels;     // nr_dpus x nr_padded x label width
+    float *distances;    // nr_dpus x nr_padded, or NULL
+    dpu_arguments_t *args;
+} predict_batch_t;
+
+// Shard i of count points over nr_dpus DPUs, sizes differing by at most one
+static void predict_shard(uint32_t count, uint32_t nr_dpus, uint32_t i, uint32_t *offset, uint32_t *size) {
+    uint32_t base = count / nr_dpus, extra = count % nr_dpus;
+    *offset = i * base + (i < extra ? i : extra);
+    *size = base + (i < extra ? 1 : 0);
+}
+
+static void pack_predict_batch(kmeans_session_t *session, predict_batch_t *batch, const float *points, int want_distances) {
+    uint32_t dims = session->model_dims;
+
+    batch->nr_padded = ALIGN_UP((batch->count + session->nr_dpus - 1) / session->nr_dpus, SHARD_ALIGN);
+    for (uint32_t i = 0; i < session->nr_dpus; i++) {
+        uint32_t offset, size;
+        float *shard = &batch->points[(size_t)i * batch->nr_padded * dims];
+        predict_shard(batch->count, session->nr_dpus, i, &offset, &size);
+        memcpy(shard, &points[((size_t)batch->first + offset) * dims], (size_t)size * dims * sizeof(float));
+        memset(&shard[(size_t)size * dims], 0, (size_t)(batch->nr_padded - size) * dims * sizeof(float));
+        memset(&batch->args[i], 0, sizeof(dpu_arguments_t));
+        batch->args[i].nr_points = size;
+        batch->args[i].nr_padded = batch->nr_padded;
+        batch->args[i].dims = dims;
+        batch->args[i].k = session->model_k;
+        batch->args[i].mode = MODE_PREDICT;
+        batch->args[i].format = POINTS_FP32;
+        batch->args[i].want_distances = want_distances;
+        batch->args[i].block_bytes = session->block_bytes;
+    }
+}
+
+static int launch_predict_batch(kmeans_session_t *session, predict_batch_t *batch) {
+    struct dpu_set_t dpu;
+    uint32_t i;
+
+    DPU_FOREACH(session->dpus, dpu, i) {
+        DPU_CHECK(dpu_prepare_xfer(dpu, &batch->points[(size_t)i * batch->nr_padded * session->model_dims]));
+    }
+    DPU_CHECK(dpu_push_xfer(session->dpus, DPU_XFER_TO_DPU, "points", 0,
+                            (size_t)batch->nr_padded * session->model_dims * sizeof(float), DPU_XFER_DEFAULT));
+    DPU_FOREACH(session->dpus, dpu, i) {
+        DPU_CHECK(dpu_prepare_xfer(dpu, &batch->args[i]));
+    }
+    DPU_CHECK(dpu_push_xfer(session->dpus, DPU_XFER_TO_DPU, "DPU_INPUT_ARGUMENTS", 0, sizeof(dpu_arguments_t), DPU_XFER_DEFAULT));
+    DPU_CHECK(dpu_launch(session->dpus, DPU_ASYNCHRONOUS));
+    return KMEANS_OK;
+}
+
+// Wait for the batch and read its labels and distances back
+static int collect_predict_batch(kmeans_session_t *session, predict_batch_t *batch) {
+    struct dpu_set_t dpu;
+    uint32_t i, width = label_bytes(session->model_k);
+
+    DPU_CHECK(dpu_sync(session->dpus));
+    DPU_FOREACH(session->dpus, dpu, i) {
+        DPU_CHECK(dpu_prepare_xfer(dpu, &batch->labels[(size_t)i * batch->nr_padded * width]));
+    }
+    DPU_CHECK(dpu_push_xfer(session->dpus, DPU_XFER_FROM_DPU, "clusters", 0, (size_t)batch->nr_padded * width, DPU_XFER_DEFAULT));
+    if (batch->distances) {
+        DPU_FOREACH(session->dpus, dpu, i) {
+            DPU_CHECK(dpu_prepare_xfer(dpu, &batch->distances[(size_t)i * batch->nr_padded]));
+        }
+        DPU_CHECK(dpu_push_xfer(session->dpus, DPU_XFER_FROM_DPU, "nearest_distances", 0, batch->nr_padded * sizeof(float),
+                                DPU_XFER_DEFAULT));
+    }
+    return KMEANS_OK;
+}
+
+static void unpack_predict_batch(kmeans_session_t *session, predict_batch_t *batch, int *labels, float *distances) {
+    uint32_t width = label_bytes(session->model_k);
+
+    for (uint32_t i = 0; i < session->nr_dpus; i++) {
+        uint32_t offset, size;
+        predict_shard(batch->count, session->nr_dpus, i, &offset, &size);
+        unpack_labels(&labels[batch->first + offset], &batch->labels[(size_t)i * batch->nr_padded * width], size, width);
+        if (distances) {
+            memcpy(&distances[batch->first + offset], &batch->distances[(size_t)i * batch->nr_padded],
+                   size * sizeof(float));
+        }
+    }
+}
+
+int kmeans_session_load_centroids(kmeans_session_t *session, const float *centroids, uint32_t k, uint32_t dims) {
+    uint32_t stride = ALIGN8(k * dims * sizeof(float)) / sizeof(float);
+    float *padded;
+    dpu_error_t status;
+
+    if (dims == 0 || dims > MAX_DIMENSIONS || k == 0 || k > MAX_K || k * dims > MAX_CENTROID_FLOATS) {
+        printf("Error: model with D=%u, K=%u is not supported (max D=%u, K=%u, KxD=%u)\n", dims, k, MAX_DIMENSIONS,
+               MAX_K, MAX_CENTROID_FLOATS);
+        return KMEANS_REJECTED;
+    }
+    if (check_dpus(session) != 0) {
+        return KMEANS_REJECTED;
+    }
+    padded = calloc(stride, sizeof(float));
+    if (!padded) {
+        return KMEANS_NO_MEMORY;
+    }
+    memcpy(padded, centroids, (size_t)k * dims * sizeof(float));
+    session->model_k = 0;
+    status = dpu_broadcast_to(session->dpus, "centroids", 0, padded, stride * sizeof(float), DPU_XFER_DEFAULT);
+    free(padded);
+    DPU_CHECK(status);
+
+    session->model_k = k;
+    session->model_dims = dims;
+    return KMEANS_OK;
+}
+
+int kmeans_session_predict(kmeans_session_t *session, const float *points, uint32_t nr_points, int *labels,
+                           float *distances) {
+    uint32_t dims = session->model_dims;
+    uint32_t per_dpu = MAX_PREDICT_POINTS;
+    uint32_t batch_points, nr_batches;
+    predict_batch_t batches[2];
+    int status = KMEANS_OK;
+
+    if (session->model_k == 0) {
+        printf("Error: no centroids loaded for prediction\n");
+        return KMEANS_REJECTED;
+    }
+    if (nr_points == 0) {
+        return KMEANS_OK;
+    }
+    session->resident = NULL;
+    if ((uint64_t)per_dpu * dims > MAX_POINT_FLOATS) {
+        per_dpu = MAX_POINT_FLOATS / dims / SHARD_ALIGN * SHARD_ALIGN;
+    }
+    batch_points = (uint64_t)per_dpu * session->nr_dpus < nr_points ? per_dpu * session->nr_dpus : nr_points;
+    nr_batches = (nr_points + batch_points - 1) / batch_points;
+
+    for (uint32_t b = 0; b < 2; b++) {
+        size_t shard_points = (size_t)session->nr_dpus * ALIGN_UP((batch_points + session->nr_dpus - 1) / session->nr_dpus, SHARD_ALIGN);
+        batches[b].points = malloc(shard_points * dims * sizeof(float));
+        batches[b].labels = malloc(shard_points * label_bytes(session->model_k));
+        batches[b].distances = distances ? malloc(shard_points * sizeof(float)) : NULL;
+        batches[b].args = malloc(session->nr_dpus * sizeof(dpu_arguments_t));
+        if (!batches[b].points || !batches[b].labels || (distances && !batches[b].distances) || !batches[b].args) {
+            status = KMEANS_NO_MEMORY;
+        }
+    }
+
+    // Pipeline: while the DPUs label batch b, the host unpacks batch b - 1 and packs batch b + 1
+    batches[0].first = 0;
+    batches[0].count = batch_points;
+    if (status == KMEANS_OK) {
+        pack_predict_batch(session, &batches[0], points, distances != NULL);
+    }
+    for (uint32_t b = 0; b < nr_batches && status == KMEANS_OK; b++) {
+        predict_batch_t *current = &batches[b % 2], *other = &batches[(b + 1) % 2];
+
+        if ((status = launch_predict_batch(session, current)) != KMEANS_OK) {
+            break;
+        }
+        if (b > 0) {
+            unpack_predict_batch(session, other, labels, distances);
+        }
+        if (b + 1 < nr_batches) {
+            other->first = current->first + current->count;
+            other->count = nr_points - other->first < batch_points ? nr_points - other->first : batch_points;
+            pack_predict_batch(session, other, points, distances != NULL);
+        }
+        status = collect_predict_batch(session, current);
+    }
+    if (status == KMEANS_OK) {
+        unpack_predict_batch(session, &batches[(nr_batches - 1) % 2], labels, distances);
+    }
+
+    for (uint32_t b = 0; b < 2; b++) {
+        free(batches[b].points);
+        free(batches[b].labels);
+        free(batches[b].distances);
+        free(batches[b].args);
+    }
+    return status;
+}
+
+void kmeans_session_submit(kmeans_session_t *session, kmeans_job_t *job) {
+    job->next = NULL;
+    if (session->queue_tail) {
+        session->queue_tail->next = job;
+    } else {
+        session->queue_head = job;
+    }
+    session->queue_tail = job;
+}
+
+int kmeans_session_drain(kmeans_session_t *session) {
+    int status = KMEANS_OK;
+
+    while (session->queue_head) {
+        kmeans_job_t *job = session->queue_head;
+        session->queue_head = job->next;
+        int job_status = kmeans_session_run(session, job);
+        if (status == KMEANS_OK || status == KMEANS_REJECTED) {
+            status = job_status != KMEANS_OK ? job_status : status;
+        }
+    }
+    session->queue_tail = NULL;
+
+    return status;
+}
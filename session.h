@@ -0,0 +1,203 @@
+#ifndef _SESSION_H_
+#define _SESSION_H_
+
+#include <stdint.h>
+#include <dpu.h>
+
+#include "common.h"
+#include "hostmem.h"
+#include "kdtree.h"
+
+// A session allocates the DPUs and loads the kernel once; any number of
+// clustering jobs of different N/D/K then reuse the resident binary and the
+// fixed MRAM layout of dpu.c.
+
+// Host reduction of the per-DPU partial sums after every iteration: below
+// REDUCE_PARALLEL_FLOATS (DPUs x K x D) it stays on the calling thread, above
+// it one thread per rank sums the rank's DPUs and the per-rank results are
+// combined in a tree, REDUCE_SLICE_FLOATS of the K x D sums per thread.
+#define REDUCE_PARALLEL_FLOATS (1 << 20)
+#define REDUCE_SLICE_FLOATS 4096
+
+// What the session functions return. A failed SDK call or allocation is
+// reported, never fatal: the process (Python's, for dpukmeans) keeps running
+// and the session can still be closed, but what the DPUs held is lost.
+enum kmeans_status {
+    KMEANS_OK = 0,
+    KMEANS_REJECTED = -1,   // The job or model is not supported, see the printed error; nothing ran
+    KMEANS_NO_MEMORY = -2,  // A host buffer could not be allocated
+    KMEANS_DPU_ERROR = -3,  // An SDK call failed
+};
+
+// Where kmeans_session_run() clusters a job: on the DPUs, on the host with
+// kd-tree filtering, or on the kd-tree up to KDTREE_AUTO_DIMENSIONS and the DPUs above
+enum kmeans_backend { BACKEND_DPU, BACKEND_KDTREE, BACKEND_AUTO };
+
+// How the points are split over the DPUs that were actually allocated
+typedef struct {
+    uint32_t nr_dpus;
+    uint32_t nr_padded;   // Uniform shard size, so one parallel transfer serves every DPU
+    uint32_t nr_groups;   // Groups of DPUs holding a full copy of the points each
+    uint32_t group_size;
+    uint32_t *offsets;    // First point of each DPU's shard
+    uint32_t *sizes;      // Real points of each DPU's shard
+} shard_layout_t;
+
+// One stage of a coarse-to-fine schedule: iterations run on the given
+// fraction of every shard before the full passes
+typedef struct {
+    float fraction;  // In (0, 1]
+    uint32_t iterations;
+} kmeans_stage_t;
+
+typedef struct kmeans_job {
+    const float *points;      // nr_points x dims, row-major; unused with a generator
+    const dpu_generator_t *generator;  // If not NULL, the DPUs generate the points themselves
+    uint32_t nr_points;
+    uint32_t dims;
+    uint32_t k;
+    uint32_t max_iterations;
+    unsigned int seed;        // Picks the k initial centroids among the points
+    uint32_t n_init;          // Restarts with seeds seed, seed + 1, ...; 0 means 1
+    uint32_t format;          // enum point_format of the points in MRAM (ignored in batch mode)
+    uint32_t spatial_order;   // Sort the points along a Z-order curve and prune centroids per
+                              // tile on the DPU (ignored in batch mode)
+    uint32_t backend;         // enum kmeans_backend (ignored in batch mode)
+    uint32_t coarse_k;        // Hierarchical mode if > 1, see kmeans_session_run()
+    uint32_t incremental;     // Keep the shards, labels and bounds on the DPUs for kmeans_session_append()
+    uint32_t compensated;     // Kahan summation of the per-DPU partial sums on the host
+    const kmeans_stage_t *schedule;  // Subsample stages, see kmeans_session_run(); may be NULL
+    uint32_t nr_stages;
+    float *centroids;         // Out: k x dims
+    int *labels;              // Out: nr_points, may be NULL
+    uint32_t iterations;      // Out: iterations actually run
+    double inertia;           // Out: sum of squared distances to the centroids, last assignment pass
+    double *history;          // Out: inertia of every iteration, may be NULL
+    unsigned int best_seed;   // Out: seed of the restart that was kept
+    double centroid_error;    // Out, POINTS_UINT16: max deviation of the centroids from the
+                              // fp32 means of the same final assignment
+    uint64_t full_searches;   // Out: points compared with all k centroids, summed over the iterations
+    uint32_t relocated;       // Out: empty clusters moved onto far points, summed over the iterations
+                              // (not counted in batch mode, where the DPUs move them)
+    uint64_t bytes_scanned;   // Out: coordinate bytes the assignment passes read from MRAM
+    uint64_t dpu_cycles;      // Out: cycles of the slowest DPU, summed over the MODE_STEP launches
+    uint64_t dpu_phase_cycles[NR_DPU_PHASES];  // Out: the same per enum dpu_phase, slowest DPU of each phase
+    struct kmeans_job *next;  // Queue link, owned by the session
+} kmeans_job_t;
+
+// Host side of one rank: where its shards are staged before a transfer
+typedef struct {
+    int node;              // NUMA node the rank is attached to, -1 if unknown
+    uint32_t first_dpu;    // Its DPUs are [first_dpu, first_dpu + nr_dpus) in DPU_FOREACH order
+    uint32_t nr_dpus;
+    uint8_t *staging;      // Shards of its DPUs as floats or uint16 (see enum point_format), on its node
+    size_t staging_size;   // Mapped bytes, see hostmem_alloc()
+} host_rank_t;
+
+typedef struct {
+    struct dpu_set_t dpus;
+    int has_dpus;              // 0 for kmeans_session_open_host()
+    uint32_t nr_dpus;
+    uint32_t nr_ranks;
+    host_rank_t *ranks;
+    uint32_t *dpu_rank;        // Rank of every DPU
+    hostmem_pool_t *pool;      // One worker per rank, on its node, for the staging and the reduction
+    shard_layout_t layout;
+    kmeans_job_t *queue_head;
+    kmeans_job_t *queue_tail;
+    // Host buffers kept across jobs
+    uint32_t *order;           // Spatial order: sorted point i is job point order[i]
+    size_t order_size;
+    float *sorted;             // Spatial order: the job's points in that order
+    size_t sorted_size;
+    float *bounds;             // Tile boxes of every shard
+    size_t bounds_size;
+    float *partial_sums;
+    size_t partial_sums_size;
+    uint8_t *partial_results;  // dpu_step_result_t of every DPU, up to counts[k]
+    size_t partial_results_size;
+    void *reduce_buffer;       // Per-segment accumulators of the host reduction
+    size_t reduce_buffer_size;
+    uint8_t *far_buffer;       // far_points then far_coordinates of every DPU, read when a cluster is empty
+    size_t far_buffer_size;
+    uint8_t *labels;           // Packed labels of every DPU, label_bytes(k) each
+    size_t labels_size;
+    uint32_t block_bytes;      // Point block size of every launch, 0 for BLOCK_BYTES (see autotune.h)
+    uint32_t nr_tasklets;      // Of the loaded binary when known from the tuning cache, else 0
+    uint32_t model_k;          // Centroids loaded for prediction, 0 if none
+    uint32_t model_dims;
+    dpu_arguments_t *args;     // Launch arguments of every DPU for the current shards
+    // Incremental job whose points are resident, NULL once anything else ran
+    const kmeans_job_t *resident;
+    uint32_t resident_points;
+    uint32_t *slots;           // Job point held by slot s of DPU i, at slots[i * slots_stride + s]
+    uint32_t slots_stride;
+    float *bounded_centroids;  // Centroids of the assignment the DPUs' bounds refer to
+    size_t bounded_centroids_size;
+} kmeans_session_t;
+
+int kmeans_session_open(kmeans_session_t *session, uint32_t nr_dpus, const char *binary);
+// Same, but looks the shape (nr_points over the DPUs actually allocated, dims,
+// k) up in the autotuning cache first: on a hit the tuned tasklet variant of
+// binary is loaded and its block size used, otherwise binary as is.
+int kmeans_session_open_tuned(kmeans_session_t *session, uint32_t nr_dpus, const char *binary, const char *cache,
+                              uint32_t nr_points, uint32_t dims, uint32_t k);
+// Same as kmeans_session_open() with a dpu_alloc() profile, e.g. "backend=simulator"
+int kmeans_session_open_profile(kmeans_session_t *session, uint32_t nr_dpus, const char *profile, const char *binary);
+// A session without DPUs, for hosts that have none: only jobs the kd-tree
+// runs are accepted (BACKEND_KDTREE, or BACKEND_AUTO at any dims), without
+// coarse level nor incremental mode; everything else is KMEANS_REJECTED.
+void kmeans_session_open_host(kmeans_session_t *session);
+void kmeans_session_close(kmeans_session_t *session);
+
+// Run one job right away; returns KMEANS_OK, or an enum kmeans_status.
+// The n_init restarts run concurrently on separate groups of DPUs, each group
+// holding a full copy of the points, and the lowest-inertia result is kept.
+int kmeans_session_run(kmeans_session_t *session, kmeans_job_t *job);
+// With coarse_k > 1, a coarse k-means with coarse_k clusters runs first, then
+// every coarse cluster is clustered on its own into its share of the k
+// centroids (in proportion to its size), the small ones one per DPU in batch
+// mode. Assignment then costs about N x (coarse_k + k / coarse_k) instead of
+// N x k. iterations and history describe the coarse level; inertia sums the
+// last assignment pass of every sub-problem.
+// With a schedule, the first iterations only assign a stratified subsample:
+// every shard is stored so that any prefix of it is spread evenly over the
+// shard, and a stage with fraction f runs on the first f of every shard. The
+// stages count in max_iterations, the last iteration is always a full pass,
+// and history holds the subsample inertia scaled to the whole job. Not
+// available with spatial_order nor for incremental jobs.
+// With a generator, every DPU fills its own shard with the points
+// generate_point() defines and nothing but the arguments is transferred; the
+// host draws the initial centroids from the same function. Generated jobs run
+// on the DPUs in POINTS_FP32, without spatial order, schedule, incremental
+// mode nor coarse level, and not in batch mode.
+
+// Incremental jobs (incremental set: DPU backend, POINTS_FP32, a single restart,
+// no spatial order nor coarse level) stop early once the centroids stop moving
+// and stay resident on the DPUs until another job runs. New points can then be
+// appended: job->points must hold the nr_resident points already clustered
+// followed by the new ones, up to job->nr_points. Only the new points are
+// transferred, the job warm-starts from job->centroids, and an old point is
+// compared with all k centroids only if its bound says it may change cluster.
+int kmeans_session_append(kmeans_session_t *session, kmeans_job_t *job, uint32_t nr_resident);
+
+// Batch mode: every job is a small independent problem clustered whole on one
+// DPU, so up to nr_dpus jobs (each with its own K and seed) share a single
+// launch. n_init is ignored. Returns KMEANS_OK, KMEANS_REJECTED if some job
+// was rejected (the others still ran), or the error that stopped the batch.
+int kmeans_session_run_batch(kmeans_session_t *session, kmeans_job_t *jobs, uint32_t nr_jobs);
+
+// Serving: load trained centroids once, then label any number of new points
+// against them. Points are cut into batches of up to MAX_PREDICT_POINTS per DPU
+// and pipelined: the host packs the next batch and unpacks the previous one
+// while the DPUs label the current one. distances (squared, to the closest
+// centroid) may be NULL. Running a training job replaces the loaded centroids.
+int kmeans_session_load_centroids(kmeans_session_t *session, const float *centroids, uint32_t k, uint32_t dims);
+int kmeans_session_predict(kmeans_session_t *session, const float *points, uint32_t nr_points, int *labels,
+                           float *distances);
+
+// Queue jobs and run them back to back on the resident program
+void kmeans_session_submit(kmeans_session_t *session, kmeans_job_t *job);
+int kmeans_session_drain(kmeans_session_t *session);
+
+#endif
@@ -0,0 +1,25 @@
+# Builds the dpukmeans Python extension (dpukmeans.c) against the UPMEM host library:
+#     python3 setup.py build_ext --inplace
+# The DPU kernel is built as usual (see README.md) and passed to dpukmeans.Session().
+import shlex
+import subprocess
+
+import numpy
+from setuptools import Extension, setup
+
+flags = shlex.split(subprocess.check_output(["dpu-pkg-config", "--cflags", "--libs", "dpu"], text=True))
+
+setup(
+    name="dpukmeans",
+    version="0.1",
+    ext_modules=[
+        Extension(
+            "dpukmeans",
+            sources=["dpukmeans.c", "session.c", "kdtree.c", "autotune.c", "hostmem.c"],
+            include_dirs=[numpy.get_include()],
+            extra_compile_args=["-O2"] + [f for f in flags if f.startswith("-I") or f.startswith("-D")],
+            extra_link_args=[f for f in flags if not (f.startswith("-I") or f.startswith("-D"))],
+            libraries=["m"],
+        )
+    ],
+)